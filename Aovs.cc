@@ -0,0 +1,169 @@
+#include <cmath>
+#include <iostream>
+
+#include "Aovs.h"
+#include "ImageFile.h"
+
+
+static const char *AOV_NAMES[NUM_AOV_CHANNELS] = {
+    "depth",
+    "normal",
+    "objectId",
+    "albedo",
+    "rays"
+};
+
+
+std::string getAovName(AovChannel channel) {
+    return AOV_NAMES[channel];
+}
+
+
+/// Find the channel called `name`. Returns false if there is none.
+bool parseAovChannel(std::string name, AovChannel &channel) {
+    for (int i = 0; i < NUM_AOV_CHANNELS; i++) {
+        if (name == AOV_NAMES[i]) {
+            channel = (AovChannel) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+Aovs::Aovs(int width, int height, const std::vector<AovChannel> &channels, const std::vector<std::shared_ptr<SceneObject>> &objects)
+: Aovs(0, 0, width, height, channels, objects)
+{}
+
+
+/// Covers only the pixels from (x0, y0), for a cropped render.
+Aovs::Aovs(int x0, int y0, int width, int height, const std::vector<AovChannel> &channels, const std::vector<std::shared_ptr<SceneObject>> &objects)
+: mX0(x0)
+, mY0(y0)
+, mWidth(width)
+, mHeight(height)
+, mEnabled{ false }
+, mIsRecorded()
+, mDepths()
+, mNormals()
+, mObjectIds()
+, mAlbedos()
+, mAlbedoCounts()
+, mRayCounts()
+, mObjectIndices()
+{
+    size_t numPixels = (size_t) width * height;
+    for (AovChannel channel : channels) {
+        mEnabled[channel] = true;
+    }
+    if (mEnabled[AOV_DEPTH] || mEnabled[AOV_NORMAL] || mEnabled[AOV_OBJECT_ID]) {
+        mIsRecorded.assign(numPixels, false);
+    }
+    if (mEnabled[AOV_DEPTH]) {
+        mDepths.assign(numPixels, INFINITY);
+    }
+    if (mEnabled[AOV_NORMAL]) {
+        mNormals.assign(numPixels, Vec3f({ 0, 0, 0 }));
+    }
+    if (mEnabled[AOV_OBJECT_ID]) {
+        mObjectIds.assign(numPixels, -1);
+        for (size_t i = 0; i < objects.size(); i++) {
+            mObjectIndices[objects[i].get()] = i;
+        }
+    }
+    if (mEnabled[AOV_ALBEDO]) {
+        mAlbedos.assign(numPixels, Vec3f({ 0, 0, 0 }));
+        mAlbedoCounts.assign(numPixels, 0);
+    }
+    if (mEnabled[AOV_RAYS]) {
+        mRayCounts.assign(numPixels, Vec3f({ 0, 0, 0 }));
+    }
+}
+
+
+bool Aovs::isEnabled(AovChannel channel) const {
+    return mEnabled[channel];
+}
+
+
+/**
+ * Add what one primary sample of a pixel hit, with `object` NULL if it hit
+ * nothing. `albedo` is only read when the albedo channel is enabled. A pixel
+ * is only ever rendered by one thread at a time, so this needs no lock.
+ */
+void Aovs::addSample(int x, int y, const SceneObject *object, float distance, Vec3f normal, Vec3f albedo) {
+    size_t i = (size_t) (y - mY0) * mWidth + (x - mX0);
+    if (!mIsRecorded.empty() && !mIsRecorded[i]) {
+        mIsRecorded[i] = true;
+        if (object != NULL) {
+            if (mEnabled[AOV_DEPTH]) {
+                mDepths[i] = distance;
+            }
+            if (mEnabled[AOV_NORMAL]) {
+                mNormals[i] = normal;
+            }
+            if (mEnabled[AOV_OBJECT_ID]) {
+                // Look up without inserting, as threads share the map.
+                const auto &indices = mObjectIndices;
+                auto found = indices.find(object);
+                mObjectIds[i] = found != indices.end() ? found->second : -1;
+            }
+        }
+    }
+    if (mEnabled[AOV_ALBEDO]) {
+        mAlbedoCounts[i]++;
+        if (object != NULL) {
+            mAlbedos[i] = add(mAlbedos[i], albedo);
+        }
+    }
+}
+
+
+/// Add the rays of each kind traced for a pixel.
+void Aovs::addRays(int x, int y, int64_t primary, int64_t shadow, int64_t secondary) {
+    size_t i = (size_t) (y - mY0) * mWidth + (x - mX0);
+    mRayCounts[i] = add(mRayCounts[i], Vec3f({ (float) primary, (float) shadow, (float) secondary }));
+}
+
+
+/**
+ * Write every enabled channel to a PFM file named after the image and the
+ * channel, so `out.ppm` gets `out.depth.pfm` and so on.
+ */
+void Aovs::write(std::string imageFile) const {
+    std::string base = imageFile;
+    std::string::size_type dot = base.rfind('.');
+    if (dot != std::string::npos && base.find('/', dot) == std::string::npos) {
+        base = base.substr(0, dot);
+    }
+
+    for (int c = 0; c < NUM_AOV_CHANNELS; c++) {
+        if (!mEnabled[c]) {
+            continue;
+        }
+        std::string file = base + "." + AOV_NAMES[c] + ".pfm";
+        switch (c) {
+            case AOV_DEPTH:
+                writeFloatImage(file, mWidth, mHeight, 1, mDepths.data());
+                break;
+            case AOV_NORMAL:
+                writeFloatImage(file, mWidth, mHeight, 3, mNormals[0].data());
+                break;
+            case AOV_OBJECT_ID:
+                writeFloatImage(file, mWidth, mHeight, 1, mObjectIds.data());
+                break;
+            case AOV_ALBEDO: {
+                std::vector<Vec3f> albedos(mAlbedos.size());
+                for (size_t i = 0; i < albedos.size(); i++) {
+                    albedos[i] = mAlbedoCounts[i] == 0 ? mAlbedos[i] : divide(mAlbedos[i], (float) mAlbedoCounts[i]);
+                }
+                writeFloatImage(file, mWidth, mHeight, 3, albedos[0].data());
+                break;
+            }
+            case AOV_RAYS:
+                writeFloatImage(file, mWidth, mHeight, 3, mRayCounts[0].data());
+                break;
+        }
+        std::cout << "Wrote " << file << std::endl;
+    }
+}
@@ -0,0 +1,80 @@
+/**
+ * @file
+ * @brief Extra per-pixel channels written alongside the image, for
+ *        compositing.
+ */
+#ifndef _AOVS_H_
+#define _AOVS_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Objects.h"
+#include "Vector.h"
+
+
+/// The channels that can be written besides the image.
+enum AovChannel {
+    AOV_DEPTH,
+    AOV_NORMAL,
+    AOV_OBJECT_ID,
+    AOV_ALBEDO,
+    AOV_RAYS,
+    NUM_AOV_CHANNELS
+};
+
+
+std::string getAovName(AovChannel channel);
+bool parseAovChannel(std::string name, AovChannel &channel);
+
+
+/**
+ * Arbitrary output variables, filled in by the render threads in the same
+ * pass as the image. Only the requested channels are allocated.
+ *
+ *   - depth: the distance to the primary hit, or infinity
+ *   - normal: the shading normal of the primary hit
+ *   - objectId: the index of the object hit in the scene, or -1
+ *   - albedo: the material color at the primary hits, averaged
+ *   - rays: the number of primary, shadow, and specular and transmission
+ *     rays the pixel took
+ *
+ * Depth, normal and object ID come from the first primary sample of each
+ * pixel and are never averaged, so a matte has no values that belong to
+ * neither of the objects on an edge. Every channel is written to its own
+ * PFM file next to the image.
+ */
+class Aovs {
+    private:
+        /// The pixels covered, in image coordinates.
+        int mX0;
+        int mY0;
+        int mWidth;
+        int mHeight;
+        bool mEnabled[NUM_AOV_CHANNELS];
+        /// Which pixels already have their first primary sample. Bytes
+        /// rather than bits, as threads set neighbouring pixels at once.
+        std::vector<char> mIsRecorded;
+        std::vector<float> mDepths;
+        std::vector<Vec3f> mNormals;
+        std::vector<float> mObjectIds;
+        std::vector<Vec3f> mAlbedos;
+        std::vector<int> mAlbedoCounts;
+        std::vector<Vec3f> mRayCounts;
+        /// The index of every object in the scene.
+        std::unordered_map<const SceneObject *, int> mObjectIndices;
+
+    public:
+        Aovs(int width, int height, const std::vector<AovChannel> &channels, const std::vector<std::shared_ptr<SceneObject>> &objects);
+        Aovs(int x0, int y0, int width, int height, const std::vector<AovChannel> &channels, const std::vector<std::shared_ptr<SceneObject>> &objects);
+        bool isEnabled(AovChannel channel) const;
+        void addSample(int x, int y, const SceneObject *object, float distance, Vec3f normal, Vec3f albedo);
+        void addRays(int x, int y, int64_t primary, int64_t shadow, int64_t secondary);
+        void write(std::string imageFile) const;
+};
+
+
+#endif
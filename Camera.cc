@@ -16,7 +16,7 @@ Camera::Camera()
 {}
 
 
-void Camera::computePrimaryRay(float pixelX, float pixelY, Vec3f &direction, Vec3f &origin) {
+void Camera::computePrimaryRay(float pixelX, float pixelY, float lensU, float lensV, Vec3f &direction, Vec3f &origin) {
     // Depth of field based on [5][6][7]
     // This is the pre-DOF ray that projects through the pixel in image space.
     Vec3f ray = normalize(Vec3f({ pixelX, pixelY, -1 }));
@@ -46,10 +46,29 @@ void Camera::computePrimaryRay(float pixelX, float pixelY, Vec3f &direction, Vec
     Vec3f imagePoint({ pixelX, pixelY, 0 });
     Vec3f aperturePoint = add(
         imagePoint,
-        randomDiskPoint(0, mApertureRadius)
+        diskPoint(0, mApertureRadius, lensU, lensV)
     );
 
     // Compute the actual primary ray!
     direction = normalize(subtract(focalPoint, aperturePoint));
     origin = aperturePoint;
 }
+
+
+/**
+ * Estimates the circle of confusion with a thin lens at the eye. The rays
+ * through every point of the aperture meet at the focal plane and spread
+ * apart again in proportion to the distance from it, so at depth d the lens
+ * covers a circle of radius r |d - f| / f for an aperture of radius r
+ * focused at depth f. Dividing by the width of a pixel at depth d gives the
+ * number of pixels a point at that depth is smeared over.
+ */
+float Camera::circleOfConfusion(const Vec3f *point, float pixelSize) {
+    float focalDepth = fmax(1e-4, mPosition[2] - mLookAt[2]);
+    if (point == NULL) {
+        return mApertureRadius / (focalDepth * pixelSize);
+    }
+
+    float depth = fmax(1e-4, mPosition[2] - (*point)[2]);
+    return mApertureRadius * fabs(depth - focalDepth) / (focalDepth * depth * pixelSize);
+}
@@ -19,9 +19,15 @@ class Camera {
         Camera();
         /**
          * Projects a ray in pixel coordinates from an aperture point to the focal
-         * plane.
+         * plane. The aperture point is placed by the sample (lensU, lensV).
          */
-        void computePrimaryRay(float pixelX, float pixelY, Vec3f &direction, Vec3f &origin);
+        void computePrimaryRay(float pixelX, float pixelY, float lensU, float lensV, Vec3f &direction, Vec3f &origin);
+        /**
+         * The radius of the blur of `point` in pixels, for pixels that are
+         * `pixelSize` wide one unit in front of the eye. A null `point` is
+         * infinitely far away.
+         */
+        float circleOfConfusion(const Vec3f *point, float pixelSize);
 };
 
 
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "Denoiser.h"
+#include "Utility.h"
+
+
+/// The weights of the B3 spline kernel along one axis.
+static const float KERNEL[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+
+
+/**
+ * The peak signal to noise ratio in decibels between two images with channels
+ * from 0 to 1. Identical images are infinitely far apart in PSNR.
+ */
+float computePSNR(const Vec3f *a, const Vec3f *b, size_t count) {
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (int c = 0; c < 3; c++) {
+            double difference = a[i][c] - b[i][c];
+            sum += difference * difference;
+        }
+    }
+    if (sum == 0) {
+        return std::numeric_limits<float>::infinity();
+    }
+    return (float) (-10 * log10(sum / (3.0 * count)));
+}
+
+
+Denoiser::Denoiser(int width, int height)
+: Denoiser(0, 0, width, height)
+{}
+
+
+/// Covers only the pixels from (x0, y0), for a cropped render.
+Denoiser::Denoiser(int x0, int y0, int width, int height)
+: mX0(x0)
+, mY0(y0)
+, mWidth(width)
+, mHeight(height)
+, mNormals((size_t) width * height, Vec3f({ 0, 0, 0 }))
+, mAlbedos((size_t) width * height, Vec3f({ 0, 0, 0 }))
+, mDepths((size_t) width * height, 0)
+, mCounts((size_t) width * height, 0)
+, mVariances((size_t) width * height, 0)
+, mPassNormals()
+, mPassAlbedos()
+, mPassDepths()
+, mDepthGradients()
+, mNormalSigma(0.1f)
+, mAlbedoSigma(0.1f)
+, mDepthSigma(1.0f)
+, mColorSigma(8)
+{}
+
+
+/// Where pixel (x, y) of the image is kept.
+size_t Denoiser::index(int x, int y) const {
+    return (size_t) (y - mY0) * mWidth + (x - mX0);
+}
+
+
+/**
+ * Add what one primary sample of a pixel hit. A pixel is only ever rendered
+ * by one thread at a time, so this needs no lock. A sample that hits nothing
+ * is added with a zero normal, albedo and depth.
+ */
+void Denoiser::addSample(int x, int y, Vec3f normal, Vec3f albedo, float depth) {
+    size_t i = index(x, y);
+    mCounts[i]++;
+    mNormals[i] = add(mNormals[i], normal);
+    mAlbedos[i] = add(mAlbedos[i], albedo);
+    mDepths[i] += depth;
+}
+
+
+/// Set the variance of the luminance of a pixel's color, once it is rendered.
+void Denoiser::setVariance(int x, int y, float variance) {
+    mVariances[index(x, y)] = variance;
+}
+
+
+Vec3f Denoiser::getNormal(int x, int y) const {
+    size_t i = index(x, y);
+    return mCounts[i] == 0 ? mNormals[i] : divide(mNormals[i], (float) mCounts[i]);
+}
+
+
+Vec3f Denoiser::getAlbedo(int x, int y) const {
+    size_t i = index(x, y);
+    return mCounts[i] == 0 ? mAlbedos[i] : divide(mAlbedos[i], (float) mCounts[i]);
+}
+
+
+float Denoiser::getDepth(int x, int y) const {
+    size_t i = index(x, y);
+    return mCounts[i] == 0 ? mDepths[i] : mDepths[i] / mCounts[i];
+}
+
+
+/**
+ * Average the guides and estimate the depth gradient of every pixel from the
+ * smaller of the differences to its neighbours on either side, so that a
+ * pixel on the edge of an object takes the gradient of its own surface.
+ */
+void Denoiser::prepareGuides() {
+    size_t numPixels = (size_t) mWidth * mHeight;
+    mPassNormals.resize(numPixels);
+    mPassAlbedos.resize(numPixels);
+    mPassDepths.resize(numPixels);
+    mDepthGradients.resize(numPixels);
+    for (int y = 0; y < mHeight; y++) {
+        for (int x = 0; x < mWidth; x++) {
+            size_t i = (size_t) y * mWidth + x;
+            mPassNormals[i] = getNormal(mX0 + x, mY0 + y);
+            mPassAlbedos[i] = getAlbedo(mX0 + x, mY0 + y);
+            mPassDepths[i] = getDepth(mX0 + x, mY0 + y);
+        }
+    }
+
+    for (int y = 0; y < mHeight; y++) {
+        for (int x = 0; x < mWidth; x++) {
+            float depth = mPassDepths[(size_t) y * mWidth + x];
+            float dx = INFINITY;
+            float dy = INFINITY;
+            if (x > 0) {
+                dx = fabs(depth - mPassDepths[(size_t) y * mWidth + x - 1]);
+            }
+            if (x + 1 < mWidth) {
+                dx = fmin(dx, fabs(depth - mPassDepths[(size_t) y * mWidth + x + 1]));
+            }
+            if (y > 0) {
+                dy = fabs(depth - mPassDepths[(size_t) (y - 1) * mWidth + x]);
+            }
+            if (y + 1 < mHeight) {
+                dy = fmin(dy, fabs(depth - mPassDepths[(size_t) (y + 1) * mWidth + x]));
+            }
+            dx = std::isinf(dx) ? 0 : dx;
+            dy = std::isinf(dy) ? 0 : dy;
+            mDepthGradients[(size_t) y * mWidth + x] = sqrtf(dx * dx + dy * dy);
+        }
+    }
+}
+
+
+/**
+ * Filter one block of pixels with the taps `step` pixels apart, and carry the
+ * variance of every pixel through the filter along with its color. Taps that
+ * fall outside the image are left out and the remaining weights normalised.
+ */
+void Denoiser::filterTile(
+    int tile,
+    int step,
+    const std::vector<Vec3f> &in,
+    const std::vector<float> &inVariances,
+    std::vector<Vec3f> &out,
+    std::vector<float> &outVariances
+) {
+    int tilesX = (mWidth + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+    int x0 = (tile % tilesX) * DENOISE_TILE_SIZE;
+    int y0 = (tile / tilesX) * DENOISE_TILE_SIZE;
+    int x1 = std::min(x0 + DENOISE_TILE_SIZE, mWidth);
+    int y1 = std::min(y0 + DENOISE_TILE_SIZE, mHeight);
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            size_t i = (size_t) y * mWidth + x;
+            Vec3f normal = mPassNormals[i];
+            Vec3f albedo = mPassAlbedos[i];
+            float depth = mPassDepths[i];
+            float gradient = mDepthGradients[i];
+            float lum = luminance(in[i]);
+
+            // The variance of a single pixel is itself noisy, so take the
+            // mean over its neighbours.
+            float variance = 0;
+            int neighbours = 0;
+            for (int sy = std::max(0, y - 1); sy <= std::min(mHeight - 1, y + 1); sy++) {
+                for (int sx = std::max(0, x - 1); sx <= std::min(mWidth - 1, x + 1); sx++) {
+                    variance += inVariances[(size_t) sy * mWidth + sx];
+                    neighbours++;
+                }
+            }
+            float lumSigma = mColorSigma * sqrtf(variance / neighbours) + 1e-4f;
+
+            Vec3f sum({ 0, 0, 0 });
+            float sumVariance = 0;
+            float totalWeight = 0;
+            for (int ky = -2; ky <= 2; ky++) {
+                int sy = y + ky * step;
+                if (sy < 0 || sy >= mHeight) {
+                    continue;
+                }
+                for (int kx = -2; kx <= 2; kx++) {
+                    int sx = x + kx * step;
+                    if (sx < 0 || sx >= mWidth) {
+                        continue;
+                    }
+                    size_t j = (size_t) sy * mWidth + sx;
+                    Vec3f normalDifference = subtract(normal, mPassNormals[j]);
+                    Vec3f albedoDifference = subtract(albedo, mPassAlbedos[j]);
+                    float distance = step * sqrtf((float) (kx * kx + ky * ky));
+                    float exponent = dot(normalDifference, normalDifference) / (mNormalSigma * mNormalSigma)
+                        + dot(albedoDifference, albedoDifference) / (mAlbedoSigma * mAlbedoSigma)
+                        + fabs(depth - mPassDepths[j]) / (mDepthSigma * gradient * distance + 1e-3f * fmax(depth, 1))
+                        + fabs(lum - luminance(in[j])) / lumSigma;
+                    float weight = KERNEL[kx + 2] * KERNEL[ky + 2] * expf(-exponent);
+                    sum = add(sum, multiply(in[j], weight));
+                    sumVariance += weight * weight * inVariances[j];
+                    totalWeight += weight;
+                }
+            }
+            out[i] = divide(sum, totalWeight);
+            outVariances[i] = sumVariance / (totalWeight * totalWeight);
+        }
+    }
+}
+
+
+/**
+ * Filter `image` in place. Each pass is spread over `numThreads` threads a
+ * block at a time, and reads what the previous pass wrote.
+ */
+void Denoiser::run(Framebuffer *image, int numThreads) {
+    prepareGuides();
+
+    size_t numPixels = (size_t) mWidth * mHeight;
+    std::vector<Vec3f> in(numPixels);
+    std::vector<Vec3f> out(numPixels);
+    std::vector<float> inVariances(numPixels);
+    std::vector<float> outVariances(numPixels);
+    std::vector<Vec3f> albedos(numPixels);
+    for (int y = 0; y < mHeight; y++) {
+        for (int x = 0; x < mWidth; x++) {
+            size_t i = (size_t) y * mWidth + x;
+            // Channels without an albedo to divide by are filtered as they are.
+            for (int c = 0; c < 3; c++) {
+                albedos[i][c] = mPassAlbedos[i][c] > 1e-3f ? mPassAlbedos[i][c] : 1;
+            }
+            in[i] = divide(image->get(mX0 + x, mY0 + y), albedos[i]);
+            float scale = luminance(albedos[i]);
+            inVariances[i] = mVariances[i] / (scale * scale);
+        }
+    }
+
+    int tilesX = (mWidth + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+    int tilesY = (mHeight + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+    for (int pass = 0; pass < DENOISE_PASSES; pass++) {
+        int step = 1 << pass;
+        parallelFor(tilesX * tilesY, numThreads, [&](int tile) {
+            filterTile(tile, step, in, inVariances, out, outVariances);
+        });
+        std::swap(in, out);
+        std::swap(inVariances, outVariances);
+    }
+
+    for (int y = 0; y < mHeight; y++) {
+        for (int x = 0; x < mWidth; x++) {
+            size_t i = (size_t) y * mWidth + x;
+            image->set(mX0 + x, mY0 + y, multiply(in[i], albedos[i]));
+        }
+    }
+}
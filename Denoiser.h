@@ -0,0 +1,98 @@
+/**
+ * @file
+ * @brief Removes the noise left by a low number of iterations after the
+ *        render, guided by what the primary rays hit.
+ */
+#ifndef _DENOISER_H_
+#define _DENOISER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "Framebuffer.h"
+#include "Vector.h"
+
+
+/// The number of à-trous passes. Three passes reach 14 pixels out, and more
+/// mostly blur the lighting rather than the noise.
+#define DENOISE_PASSES 3
+/// The size of the square blocks of pixels that threads filter.
+#define DENOISE_TILE_SIZE 32
+
+
+float computePSNR(const Vec3f *a, const Vec3f *b, size_t count);
+
+
+/**
+ * An edge-avoiding à-trous wavelet filter [18]. Each pass blurs the image
+ * with a 5x5 B3 spline kernel whose taps are spread twice as far apart as the
+ * pass before, so a few passes cover a wide area at the cost of 25 taps per
+ * pixel each. Every tap is weighted by how alike the two pixels' normals,
+ * albedos and depths are, so the blur stops at the edges of objects and
+ * textures.
+ *
+ * Taps are also weighted by how far apart the two pixels' luminances are
+ * relative to the noise in them, as in [19]. The variance of every pixel is
+ * measured while rendering and carried through each pass, so noisy
+ * penumbrae are smoothed while clean lighting and shadow edges are kept.
+ *
+ * The guide buffers are averages of the primary hits of each pixel, added
+ * while rendering. The color is divided by the albedo before filtering and
+ * multiplied by it afterwards, so textures stay sharp while the lighting on
+ * them is smoothed.
+ */
+class Denoiser {
+    private:
+        /// The pixels covered, in image coordinates.
+        int mX0;
+        int mY0;
+        int mWidth;
+        int mHeight;
+        /// Sums over the primary samples of each pixel.
+        std::vector<Vec3f> mNormals;
+        std::vector<Vec3f> mAlbedos;
+        std::vector<float> mDepths;
+        std::vector<int> mCounts;
+        /// The variance of the luminance of each pixel's color.
+        std::vector<float> mVariances;
+
+        /// The averaged guides while filtering.
+        std::vector<Vec3f> mPassNormals;
+        std::vector<Vec3f> mPassAlbedos;
+        std::vector<float> mPassDepths;
+        /// How fast depth changes across each pixel, to tell a surface at a
+        /// grazing angle from separate surfaces.
+        std::vector<float> mDepthGradients;
+
+        size_t index(int x, int y) const;
+        void prepareGuides();
+        void filterTile(
+            int tile,
+            int step,
+            const std::vector<Vec3f> &in,
+            const std::vector<float> &inVariances,
+            std::vector<Vec3f> &out,
+            std::vector<float> &outVariances
+        );
+
+    public:
+        /// How different normals, albedos and relative depths can be before
+        /// the filter stops blurring across them, and how many standard
+        /// deviations of its noise a pixel's luminance can be off.
+        float mNormalSigma;
+        float mAlbedoSigma;
+        float mDepthSigma;
+        float mColorSigma;
+
+        Denoiser(int width, int height);
+        Denoiser(int x0, int y0, int width, int height);
+        void addSample(int x, int y, Vec3f normal, Vec3f albedo, float depth);
+        void setVariance(int x, int y, float variance);
+        Vec3f getNormal(int x, int y) const;
+        Vec3f getAlbedo(int x, int y) const;
+        float getDepth(int x, int y) const;
+        void run(Framebuffer *image, int numThreads);
+};
+
+
+#endif
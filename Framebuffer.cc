@@ -0,0 +1,232 @@
+#ifdef __linux__
+#  include <sys/mman.h>
+#endif
+#include <cmath>
+#include <cstring>
+
+#include "Framebuffer.h"
+#include "Utility.h"
+#include "Vector.h"
+
+
+#define PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+
+/**
+ * Convert a float to the nearest half float, rounding ties to even. Values
+ * too large for a half become infinity and values too small become zero.
+ */
+uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff) {
+        // Infinity stays infinity and NaN stays NaN.
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+    int halfExponent = (int) exponent - 127 + 15;
+    if (halfExponent >= 0x1f) {
+        return sign | 0x7c00;
+    }
+    if (halfExponent <= 0) {
+        // A subnormal half, or zero.
+        if (halfExponent < -10) {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        int shift = 14 - halfExponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            half++;
+        }
+        return sign | half;
+    }
+
+    uint32_t half = (halfExponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    // Rounding up can carry into the exponent, which is still correct.
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return sign | half;
+}
+
+
+float halfToFloat(uint16_t half) {
+    uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Normalise a subnormal half.
+        int shift = 0;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            shift++;
+        }
+        bits = sign | ((uint32_t) (127 - 15 + 1 - shift) << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+Framebuffer::Framebuffer(int width, int height, bool useHugePages)
+: Framebuffer(0, 0, width, height, useHugePages, FLOAT_RGB)
+{}
+
+
+Framebuffer::Framebuffer(int x0, int y0, int width, int height, bool useHugePages, FramebufferFormat format)
+: mPixels(NULL)
+, mFormat(format)
+, mBytesPerPixel(format == FLOAT_RGB ? 12 : format == HALF_RGB ? 6 : 4)
+, mX0(x0)
+, mY0(y0)
+, mWidth(width)
+, mHeight(height)
+{
+    size_t bytes = (size_t) width * height * mBytesPerPixel;
+    // Huge pages are only worthwhile for images spanning several of them.
+    bool hugePages = useHugePages && bytes >= 4 * HUGE_PAGE_SIZE;
+    size_t alignment = hugePages ? HUGE_PAGE_SIZE : PAGE_SIZE;
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+    mPixels = (unsigned char *) allocateAligned(bytes, alignment);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (hugePages) {
+        // Only advice: it is fine if transparent huge pages are disabled.
+        madvise(mPixels, bytes, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+
+Framebuffer::~Framebuffer() {
+    freeAligned(mPixels);
+}
+
+
+size_t Framebuffer::index(int x, int y) const {
+    return (size_t) (y - mY0) * mWidth + (x - mX0);
+}
+
+
+Vec3f Framebuffer::get(int x, int y) const {
+    const unsigned char *pixel = mPixels + index(x, y) * mBytesPerPixel;
+    switch (mFormat) {
+        case HALF_RGB: {
+            const uint16_t *half = (const uint16_t *) pixel;
+            return Vec3f({ halfToFloat(half[0]), halfToFloat(half[1]), halfToFloat(half[2]) });
+        }
+        case RGBE: {
+            if (pixel[3] == 0) {
+                return Vec3f({ 0, 0, 0 });
+            }
+            float scale = ldexpf(1, (int) pixel[3] - (128 + 8));
+            return Vec3f({ pixel[0] * scale, pixel[1] * scale, pixel[2] * scale });
+        }
+        default:
+            return *(const Vec3f *) pixel;
+    }
+}
+
+
+/**
+ * Store a color in the framebuffer's format. RGBE cannot hold negative
+ * channels, so they are stored as zero.
+ */
+void Framebuffer::set(int x, int y, Vec3f color) {
+    unsigned char *pixel = mPixels + index(x, y) * mBytesPerPixel;
+    switch (mFormat) {
+        case HALF_RGB: {
+            uint16_t *half = (uint16_t *) pixel;
+            for (int c = 0; c < 3; c++) {
+                half[c] = floatToHalf(color[c]);
+            }
+            break;
+        }
+        case RGBE: {
+            float largest = fmax(color[0], fmax(color[1], color[2]));
+            if (!(largest > 1e-32f)) {
+                memset(pixel, 0, 4);
+                break;
+            }
+            // Round to the nearest mantissa, so that a zero channel decodes
+            // as zero, and move up an exponent if the largest rounds to 256.
+            int exponent;
+            float scale = frexpf(largest, &exponent) * 256 / largest;
+            if (largest * scale + 0.5f >= 256) {
+                exponent++;
+                scale *= 0.5f;
+            }
+            for (int c = 0; c < 3; c++) {
+                pixel[c] = (unsigned char) fmax(0, color[c] * scale + 0.5f);
+            }
+            pixel[3] = (unsigned char) (exponent + 128);
+            break;
+        }
+        default:
+            *(Vec3f *) pixel = color;
+    }
+}
+
+
+/**
+ * The pixels of row `y`. A FLOAT_RGB framebuffer returns the row itself;
+ * the others convert it into `scratch`, which must hold a row.
+ */
+const Vec3f *Framebuffer::getRow(int y, Vec3f *scratch) const {
+    if (mFormat == FLOAT_RGB) {
+        return (const Vec3f *) (mPixels + index(mX0, y) * mBytesPerPixel);
+    }
+    for (int x = 0; x < mWidth; x++) {
+        scratch[x] = get(mX0 + x, y);
+    }
+    return scratch;
+}
+
+
+/**
+ * Clear the inclusive range of rows from the calling thread, which places
+ * their pages on that thread's NUMA node.
+ */
+void Framebuffer::touchRows(int y0, int y1) {
+    if (y1 < y0) {
+        return;
+    }
+    memset((void *) (mPixels + index(mX0, y0) * mBytesPerPixel), 0, (size_t) (y1 - y0 + 1) * mWidth * mBytesPerPixel);
+}
+
+
+FramebufferFormat Framebuffer::getFormat() const {
+    return mFormat;
+}
+
+
+/// The memory the pixels take up.
+size_t Framebuffer::getBytes() const {
+    return (size_t) mWidth * mHeight * mBytesPerPixel;
+}
+
+
+/// The pixels of a FLOAT_RGB framebuffer.
+Vec3f *Framebuffer::data() {
+    return (Vec3f *) mPixels;
+}
+
+
+const Vec3f *Framebuffer::data() const {
+    return (const Vec3f *) mPixels;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file
+ * @brief Owns the memory the rendered image is written into.
+ */
+#ifndef _FRAMEBUFFER_H_
+#define _FRAMEBUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Vector.h"
+
+
+/// How the pixels of a framebuffer are stored.
+enum FramebufferFormat {
+    /// Three floats, 12 bytes per pixel.
+    FLOAT_RGB,
+    /// Three half floats, 6 bytes per pixel.
+    HALF_RGB,
+    /// Three 8-bit mantissas sharing an 8-bit exponent [20], 4 bytes per
+    /// pixel.
+    RGBE
+};
+
+
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t half);
+
+
+/**
+ * The pixels are left untouched when allocated. The operating system places
+ * each page on the NUMA node of the thread that first writes to it, so the
+ * render threads can decide where the image lives by touching their own rows
+ * first.
+ *
+ * A framebuffer can also hold just a window of a larger image, such as a
+ * single tile, and is then addressed with the larger image's coordinates.
+ *
+ * The compact formats trade precision for memory. They are converted to and
+ * from floats in `get` and `set`, so callers only ever see colors; a render
+ * thread averages a pixel's iterations in floats and stores the result once.
+ * Only a FLOAT_RGB framebuffer can be read directly through `data`.
+ */
+class Framebuffer {
+    private:
+        unsigned char *mPixels;
+        FramebufferFormat mFormat;
+        size_t mBytesPerPixel;
+
+    public:
+        /// The image coordinates of the top left pixel.
+        int mX0;
+        int mY0;
+        int mWidth;
+        int mHeight;
+
+        Framebuffer(int width, int height, bool useHugePages);
+        Framebuffer(int x0, int y0, int width, int height, bool useHugePages, FramebufferFormat format);
+        ~Framebuffer();
+        Framebuffer(const Framebuffer &) = delete;
+        Framebuffer &operator=(const Framebuffer &) = delete;
+
+        size_t index(int x, int y) const;
+        Vec3f get(int x, int y) const;
+        void set(int x, int y, Vec3f color);
+        const Vec3f *getRow(int y, Vec3f *scratch) const;
+        void touchRows(int y0, int y1);
+        FramebufferFormat getFormat() const;
+        size_t getBytes() const;
+        Vec3f *data();
+        const Vec3f *data() const;
+};
+
+
+#endif
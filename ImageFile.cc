@@ -1,17 +1,543 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <fstream>
+#include <iostream>
 #include <string>
+#include <vector>
+#include <zlib.h>
 
 #include "ImageFile.h"
+#include "Utility.h"
 #include "Vector.h"
 
 
-void writeImage(const std::string file, const int width, const int height, const Vec3f *image) {
+/// The number of rows a thread encodes at a time.
+#define ENCODE_ROWS 16
+/// The number of rows of a PNG that a thread filters and deflates at a time.
+/// Each strip costs the compression of its first rows some context.
+#define PNG_STRIP_ROWS 64
+/// The largest IDAT chunk written.
+#define PNG_MAX_CHUNK (1 << 30)
+
+
+/// Whether this machine stores the least significant byte of a number first.
+bool isLittleEndian() {
+    uint16_t one = 1;
+    return *(const unsigned char *) &one == 1;
+}
+
+
+/// The 4x4 Bayer matrix, scaled to offsets below one 8.8 fixed point step.
+static const uint16_t DITHER_OFFSETS[4][4] = {
+    { 8, 136, 40, 168 },
+    { 200, 72, 232, 104 },
+    { 56, 184, 24, 152 },
+    { 248, 120, 216, 88 }
+};
+
+
+/// Clamp a channel to [0, 1], with NaN going to 0.
+static inline float clampChannel(float value) {
+    return value > 0 ? (value < 1 ? value : 1) : 0;
+}
+
+
+ImageEncoder::ImageEncoder(float gamma, bool dither)
+: mGamma(gamma)
+, mDither(dither)
+, mGammaTable()
+{
+    if (mGamma != 1) {
+        mGammaTable.resize(GAMMA_TABLE_SIZE);
+        for (int i = 0; i < GAMMA_TABLE_SIZE; i++) {
+            float value = powf(i / (float) (GAMMA_TABLE_SIZE - 1), 1 / mGamma);
+            mGammaTable[i] = (uint16_t) (value * 255 * 256);
+        }
+    }
+}
+
+
+/**
+ * Encode `count` pixels of a row, starting with pixel (`x`, `y`), into three
+ * bytes each. Without gamma or dither this truncates each clamped channel
+ * times 255, as the writer always has.
+ */
+void ImageEncoder::encode(const Vec3f *pixels, size_t count, int x, int y, unsigned char *output) const {
+    const float *channels = pixels[0].data();
+    if (mGamma == 1 && !mDither) {
+        size_t numChannels = count * 3;
+        for (size_t i = 0; i < numChannels; i++) {
+            output[i] = (unsigned char) (clampChannel(channels[i]) * 255);
+        }
+        return;
+    }
+
+    const uint16_t *ditherRow = DITHER_OFFSETS[y & 3];
+    for (size_t p = 0; p < count; p++) {
+        uint32_t offset = mDither ? ditherRow[(x + p) & 3] : 0;
+        for (int c = 0; c < 3; c++) {
+            float value = clampChannel(channels[3 * p + c]);
+            uint32_t fixed;
+            if (mGamma != 1) {
+                fixed = mGammaTable[(int) (value * (GAMMA_TABLE_SIZE - 1) + 0.5f)];
+            } else {
+                fixed = (uint32_t) (value * 255 * 256);
+            }
+            output[3 * p + c] = (unsigned char) std::min((fixed + offset) >> 8, (uint32_t) 255);
+        }
+    }
+}
+
+
+/// Which codec to write `file` with, from its extension.
+ImageFormat getImageFormat(const std::string file) {
+    std::string::size_type dot = file.rfind('.');
+    if (dot == std::string::npos) {
+        return PPM;
+    }
+    std::string extension = file.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension == "qoi") {
+        return QOI;
+    }
+    if (extension == "png") {
+        return PNG;
+    }
+    return PPM;
+}
+
+
+static void appendBigEndian(std::vector<unsigned char> &buffer, uint32_t value) {
+    buffer.push_back(value >> 24);
+    buffer.push_back(value >> 16);
+    buffer.push_back(value >> 8);
+    buffer.push_back(value);
+}
+
+
+/**
+ * Encode 8-bit RGB pixels as a QOI image [21]. Each pixel becomes a run of
+ * the previous pixel, an index into the 64 most recently seen colors, a
+ * small difference from the previous pixel, or the literal color, which
+ * takes a single pass with no searching.
+ */
+std::vector<unsigned char> encodeQoi(const unsigned char *pixels, int width, int height) {
+    std::vector<unsigned char> buffer = { 'q', 'o', 'i', 'f' };
+    buffer.reserve((size_t) width * height * 4 + 22);
+    appendBigEndian(buffer, width);
+    appendBigEndian(buffer, height);
+    buffer.push_back(3);
+    // Every channel is linear unless the image was gamma corrected, but QOI
+    // only describes the color space and decoders ignore it.
+    buffer.push_back(0);
+
+    // Decoders start the seen colors off transparent, which no pixel here is.
+    unsigned char seen[64][3] = { { 0 } };
+    bool isSeen[64] = { false };
+    unsigned char previous[3] = { 0, 0, 0 };
+    int run = 0;
+    size_t numPixels = (size_t) width * height;
+    for (size_t i = 0; i < numPixels; i++) {
+        const unsigned char *pixel = pixels + 3 * i;
+        if (pixel[0] == previous[0] && pixel[1] == previous[1] && pixel[2] == previous[2]) {
+            run++;
+            if (run == 62 || i + 1 == numPixels) {
+                buffer.push_back(0xc0 | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            buffer.push_back(0xc0 | (run - 1));
+            run = 0;
+        }
+
+        // The alpha of every pixel is 255.
+        int hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + 255 * 11) % 64;
+        if (isSeen[hash] && seen[hash][0] == pixel[0] && seen[hash][1] == pixel[1] && seen[hash][2] == pixel[2]) {
+            buffer.push_back(hash);
+        } else {
+            isSeen[hash] = true;
+            seen[hash][0] = pixel[0];
+            seen[hash][1] = pixel[1];
+            seen[hash][2] = pixel[2];
+            signed char dr = pixel[0] - previous[0];
+            signed char dg = pixel[1] - previous[1];
+            signed char db = pixel[2] - previous[2];
+            signed char drg = dr - dg;
+            signed char dbg = db - dg;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                buffer.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+            } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                buffer.push_back(0x80 | (dg + 32));
+                buffer.push_back((drg + 8) << 4 | (dbg + 8));
+            } else {
+                buffer.push_back(0xfe);
+                buffer.push_back(pixel[0]);
+                buffer.push_back(pixel[1]);
+                buffer.push_back(pixel[2]);
+            }
+        }
+        previous[0] = pixel[0];
+        previous[1] = pixel[1];
+        previous[2] = pixel[2];
+    }
+
+    buffer.insert(buffer.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+    return buffer;
+}
+
+
+static int paethPredictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+
+/**
+ * Filter one row of a PNG with each of the five filters and keep the one
+ * whose bytes are smallest as signed values, the heuristic libpng uses.
+ * `above` is NULL for the first row. Writes the filter type and the
+ * filtered row to `output`.
+ */
+static void filterPngRow(const unsigned char *row, const unsigned char *above, size_t rowBytes, unsigned char *output, std::vector<unsigned char> &candidate) {
+    long bestScore = -1;
+    candidate.resize(rowBytes);
+    for (int filter = 0; filter < 5; filter++) {
+        long score = 0;
+        for (size_t i = 0; i < rowBytes; i++) {
+            int left = i >= 3 ? row[i - 3] : 0;
+            int up = above != NULL ? above[i] : 0;
+            int upLeft = above != NULL && i >= 3 ? above[i - 3] : 0;
+            int predicted = 0;
+            switch (filter) {
+                case 1: predicted = left; break;
+                case 2: predicted = up; break;
+                case 3: predicted = (left + up) / 2; break;
+                case 4: predicted = paethPredictor(left, up, upLeft); break;
+            }
+            unsigned char value = row[i] - predicted;
+            candidate[i] = value;
+            score += value < 128 ? value : 256 - value;
+        }
+        if (bestScore < 0 || score < bestScore) {
+            bestScore = score;
+            output[0] = filter;
+            std::copy(candidate.begin(), candidate.end(), output + 1);
+        }
+    }
+}
+
+
+static void appendPngChunk(std::vector<unsigned char> &buffer, const char *type, const unsigned char *data, size_t size) {
+    appendBigEndian(buffer, size);
+    size_t start = buffer.size();
+    buffer.insert(buffer.end(), type, type + 4);
+    buffer.insert(buffer.end(), data, data + size);
+    appendBigEndian(buffer, crc32(0, buffer.data() + start, size + 4));
+}
+
+
+/**
+ * Encode 8-bit RGB pixels as a PNG image. The rows are split into strips
+ * that `numThreads` threads filter and deflate independently, as pigz
+ * does: every strip but the last ends on a byte boundary with a sync flush
+ * and without the final block, so the strips put end to end make one
+ * deflate stream. Their Adler-32 checksums combine into the checksum of the
+ * whole stream without reading it again.
+ */
+std::vector<unsigned char> encodePng(const unsigned char *pixels, int width, int height, int numThreads) {
+    size_t rowBytes = (size_t) width * 3;
+    int numStrips = (height + PNG_STRIP_ROWS - 1) / PNG_STRIP_ROWS;
+    std::vector<std::vector<unsigned char>> strips(numStrips);
+    std::vector<uLong> checksums(numStrips);
+    parallelFor(numStrips, numThreads, [&](int strip) {
+        int y0 = strip * PNG_STRIP_ROWS;
+        int y1 = std::min(height, y0 + PNG_STRIP_ROWS);
+        std::vector<unsigned char> filtered((rowBytes + 1) * (y1 - y0));
+        std::vector<unsigned char> candidate;
+        for (int y = y0; y < y1; y++) {
+            filterPngRow(
+                pixels + y * rowBytes,
+                y > 0 ? pixels + (y - 1) * rowBytes : NULL,
+                rowBytes,
+                filtered.data() + (y - y0) * (rowBytes + 1),
+                candidate
+            );
+        }
+        checksums[strip] = adler32(adler32(0, NULL, 0), filtered.data(), filtered.size());
+
+        z_stream stream;
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        // Raw deflate, as the strips share one zlib header and checksum.
+        deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        std::vector<unsigned char> &compressed = strips[strip];
+        compressed.resize(deflateBound(&stream, filtered.size()) + 16);
+        stream.next_in = filtered.data();
+        stream.avail_in = filtered.size();
+        stream.next_out = compressed.data();
+        stream.avail_out = compressed.size();
+        deflate(&stream, strip + 1 == numStrips ? Z_FINISH : Z_SYNC_FLUSH);
+        compressed.resize(compressed.size() - stream.avail_out);
+        deflateEnd(&stream);
+    });
+
+    std::vector<unsigned char> zlibStream = { 0x78, 0x9c };
+    uLong checksum = adler32(0, NULL, 0);
+    for (int strip = 0; strip < numStrips; strip++) {
+        zlibStream.insert(zlibStream.end(), strips[strip].begin(), strips[strip].end());
+        int y0 = strip * PNG_STRIP_ROWS;
+        int rows = std::min(height, y0 + PNG_STRIP_ROWS) - y0;
+        checksum = adler32_combine(checksum, checksums[strip], (z_off_t) (rowBytes + 1) * rows);
+    }
+    appendBigEndian(zlibStream, checksum);
+
+    std::vector<unsigned char> buffer = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<unsigned char> header;
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    // 8 bits per channel, RGB, deflate, adaptive filtering, no interlacing.
+    header.insert(header.end(), { 8, 2, 0, 0, 0 });
+    appendPngChunk(buffer, "IHDR", header.data(), header.size());
+    for (size_t offset = 0; offset < zlibStream.size(); offset += PNG_MAX_CHUNK) {
+        size_t size = std::min((size_t) PNG_MAX_CHUNK, zlibStream.size() - offset);
+        appendPngChunk(buffer, "IDAT", zlibStream.data() + offset, size);
+    }
+    appendPngChunk(buffer, "IEND", NULL, 0);
+    return buffer;
+}
+
+
+/**
+ * Encode every row of `image` into `pixels`, `rowBytes` apart, with
+ * `numThreads` threads a block of rows at a time. Pixels are dithered by
+ * where they are in the whole image, so a cropped image encodes to the same
+ * bytes as the same pixels of the whole image.
+ */
+static void encodeImage(const Framebuffer &image, const ImageEncoder &encoder, int numThreads, unsigned char *pixels, size_t rowBytes) {
+    int width = image.mWidth;
+    int height = image.mHeight;
+    // Blocks of rows are big enough to be worth a thread picking up.
+    int numBlocks = (height + ENCODE_ROWS - 1) / ENCODE_ROWS;
+    parallelFor(numBlocks, numThreads, [&](int block) {
+        std::vector<Vec3f> scratch(width);
+        int y1 = std::min(height, (block + 1) * ENCODE_ROWS);
+        for (int y = block * ENCODE_ROWS; y < y1; y++) {
+            const Vec3f *row = image.getRow(image.mY0 + y, scratch.data());
+            encoder.encode(row, width, image.mX0, image.mY0 + y, pixels + y * rowBytes);
+        }
+    });
+}
+
+
+/**
+ * Write 8-bit RGB pixels that start `headerSize` bytes into `buffer` to a
+ * file in the format its extension asks for. The space in front is where the
+ * PPM header goes, so that a PPM is written with a single call. Returns the
+ * size of the file in bytes.
+ */
+static size_t writeEncodedImage(const std::string file, std::vector<unsigned char> &buffer, size_t headerSize, int width, int height, int numThreads) {
+    ImageFormat format = getImageFormat(file);
+    if (format == QOI) {
+        buffer = encodeQoi(buffer.data() + headerSize, width, height);
+    } else if (format == PNG) {
+        buffer = encodePng(buffer.data() + headerSize, width, height, numThreads);
+    }
+
+    std::ofstream img(file, std::ios::out | std::ios::binary);
+    img.write((const char *) buffer.data(), buffer.size());
+    img.close();
+    return buffer.size();
+}
+
+
+static std::string getPpmHeader(const std::string file, int width, int height) {
+    if (getImageFormat(file) != PPM) {
+        return "";
+    }
+    return "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+}
+
+
+/**
+ * Write `image` to a file in the format its extension asks for: QOI for
+ * `.qoi`, PNG for `.png` and binary PPM otherwise. The rows are encoded into
+ * one buffer by `numThreads` threads and written with a single call. Returns
+ * the size of the file in bytes.
+ */
+size_t writeImage(const std::string file, const Framebuffer &image, const ImageEncoder &encoder, int numThreads) {
+    int width = image.mWidth;
+    int height = image.mHeight;
+    std::string header = getPpmHeader(file, width, height);
+    size_t rowBytes = (size_t) width * 3;
+    std::vector<unsigned char> buffer(header.size() + rowBytes * height);
+    std::copy(header.begin(), header.end(), buffer.begin());
+    encodeImage(image, encoder, numThreads, buffer.data() + header.size(), rowBytes);
+    return writeEncodedImage(file, buffer, header.size(), width, height, numThreads);
+}
+
+
+/**
+ * Read a binary PPM with 8 bits per channel, as this writes them. Returns
+ * false if the file can't be read or is some other kind of image.
+ */
+bool readImage(const std::string file, int &width, int &height, std::vector<unsigned char> &pixels) {
+    std::ifstream img(file, std::ios::in | std::ios::binary);
+    std::string magic;
+    int maxValue = 0;
+    img >> magic;
+    // Skip comments between the fields of the header.
+    auto skipComments = [&img]() {
+        img >> std::ws;
+        while (img.peek() == '#') {
+            std::string comment;
+            std::getline(img, comment);
+            img >> std::ws;
+        }
+    };
+    skipComments();
+    img >> width;
+    skipComments();
+    img >> height;
+    skipComments();
+    img >> maxValue;
+    if (!img || magic != "P6" || maxValue != 255 || width <= 0 || height <= 0) {
+        return false;
+    }
+    // A single whitespace character separates the header from the pixels.
+    img.get();
+    pixels.resize((size_t) width * height * 3);
+    img.read((char *) pixels.data(), pixels.size());
+    return (size_t) img.gcount() == pixels.size();
+}
+
+
+/**
+ * Encode `image`, a region of a larger image, over the same pixels of the
+ * PPM `background` and write the result to `file` in the format its extension
+ * asks for. `background` may be `file` itself. Returns the size of the file
+ * in bytes, or zero if `background` can't be read or is not `fullWidth` by
+ * `fullHeight`.
+ */
+size_t compositeImage(
+    const std::string file,
+    const std::string background,
+    int fullWidth,
+    int fullHeight,
+    const Framebuffer &image,
+    const ImageEncoder &encoder,
+    int numThreads
+) {
+    int width, height;
+    std::vector<unsigned char> pixels;
+    if (!readImage(background, width, height, pixels) || width != fullWidth || height != fullHeight) {
+        return 0;
+    }
+
+    std::string header = getPpmHeader(file, width, height);
+    size_t rowBytes = (size_t) width * 3;
+    std::vector<unsigned char> buffer(header.size() + pixels.size());
+    std::copy(header.begin(), header.end(), buffer.begin());
+    std::copy(pixels.begin(), pixels.end(), buffer.begin() + header.size());
+    unsigned char *origin = buffer.data() + header.size() + image.mY0 * rowBytes + image.mX0 * 3;
+    encodeImage(image, encoder, numThreads, origin, rowBytes);
+    return writeEncodedImage(file, buffer, header.size(), width, height, numThreads);
+}
+
+
+ImageStream::ImageStream(const std::string file, int width, int height, const ImageEncoder &encoder)
+: ImageStream(file, 0, 0, width, height, encoder)
+{}
+
+
+/// A file of just the pixels from (x0, y0), for a cropped render.
+ImageStream::ImageStream(const std::string file, int x0, int y0, int width, int height, const ImageEncoder &encoder)
+: mFile(-1)
+, mX0(x0)
+, mY0(y0)
+, mWidth(width)
+, mHeight(height)
+, mHeaderSize(0)
+, mEncoder(encoder)
+, mFailed(false)
+{
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    mHeaderSize = header.size();
+    mFile = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (mFile < 0
+            || pwrite(mFile, header.data(), header.size(), 0) != (ssize_t) header.size()
+            || ftruncate(mFile, size()) != 0) {
+        std::cout << "Could not create " << file << " for streaming output." << std::endl;
+        throw "Could not create the output file for streaming output.";
+    }
+}
+
+
+ImageStream::~ImageStream() {
+    if (mFile >= 0) {
+        close(mFile);
+    }
+}
+
+
+/// The size of the whole file in bytes.
+uint64_t ImageStream::size() const {
+    return mHeaderSize + (uint64_t) mWidth * mHeight * 3;
+}
+
+
+/**
+ * Encode a finished tile and write each of its rows to its place in the file.
+ * Render threads call this, so instead of throwing it returns false, and
+ * hasFailed() says so from then on.
+ */
+bool ImageStream::commitTile(const Framebuffer &tile) {
+    std::vector<unsigned char> row((size_t) tile.mWidth * 3);
+    std::vector<Vec3f> scratch(tile.mWidth);
+    for (int y = tile.mY0; y < tile.mY0 + tile.mHeight; y++) {
+        mEncoder.encode(tile.getRow(y, scratch.data()), tile.mWidth, tile.mX0, y, row.data());
+        uint64_t offset = mHeaderSize + ((uint64_t) (y - mY0) * mWidth + tile.mX0 - mX0) * 3;
+        size_t written = 0;
+        while (written < row.size()) {
+            ssize_t result = pwrite(mFile, row.data() + written, row.size() - written, offset + written);
+            if (result <= 0) {
+                mFailed = true;
+                return false;
+            }
+            written += result;
+        }
+    }
+    return true;
+}
+
+
+bool ImageStream::hasFailed() const {
+    return mFailed;
+}
+
+
+/**
+ * Write `channels` (1 or 3) floats per pixel to a PFM image, which keeps
+ * them exactly. PFM stores the rows bottom to top, and a negative scale
+ * marks the floats as little endian.
+ */
+void writeFloatImage(const std::string file, const int width, const int height, const int channels, const float *image) {
     std::ofstream img(file, std::ios::out | std::ios::binary);
-    img << "P6\n" << width << " " << height << "\n255\n";
-    for (int i = 0; i < width * height; i++) {
-        img << (unsigned char)(image[i][0] * 255) <<
-               (unsigned char)(image[i][1] * 255) <<
-               (unsigned char)(image[i][2] * 255);
+    img << (channels == 3 ? "PF" : "Pf") << "\n" << width << " " << height << "\n";
+    img << (isLittleEndian() ? "-1.0" : "1.0") << "\n";
+    for (int y = height - 1; y >= 0; y--) {
+        img.write((const char *) (image + (size_t) y * width * channels), sizeof(float) * width * channels);
     }
     img.close();
 }
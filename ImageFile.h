@@ -1,16 +1,101 @@
 /**
  * @file
- * @brief Writes an array of color vectors to a PPM image.
+ * @brief Writes an array of color vectors to a PPM, QOI or PNG image, and
+ *        arrays of floats to PFM images.
  */
 #ifndef _IMAGE_FILE_H_
 #define _IMAGE_FILE_H_
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
+#include "Framebuffer.h"
 #include "Vector.h"
 
 
-void writeImage(const std::string file, const int width, const int height, const Vec3f *image);
+/// The codecs images can be written with.
+enum ImageFormat {
+    PPM,
+    QOI,
+    PNG
+};
+
+
+/// The number of entries in the gamma lookup table.
+#define GAMMA_TABLE_SIZE 16384
+
+
+/**
+ * Turns colors into 8-bit channels. Channels are clamped to [0, 1], then
+ * optionally gamma corrected through a lookup table and dithered with a 4x4
+ * ordered dither before being truncated. The dither only depends on where a
+ * pixel is, so any part of an image encodes the same on its own as it does
+ * as part of the whole.
+ */
+class ImageEncoder {
+    private:
+        float mGamma;
+        bool mDither;
+        /// Gamma corrected channels in 8.8 fixed point, when correcting.
+        std::vector<uint16_t> mGammaTable;
+
+    public:
+        ImageEncoder(float gamma, bool dither);
+        void encode(const Vec3f *pixels, size_t count, int x, int y, unsigned char *output) const;
+};
+
+
+/**
+ * A PPM file that finished tiles are written straight into, so the whole
+ * image never has to be in memory. The file is created at its full size up
+ * front and each row of a tile is encoded and written to its own offset with
+ * `pwrite`, which is safe to call from several threads at once.
+ */
+class ImageStream {
+    private:
+        int mFile;
+        /// The pixels in the file, in image coordinates.
+        int mX0;
+        int mY0;
+        int mWidth;
+        int mHeight;
+        uint64_t mHeaderSize;
+        ImageEncoder mEncoder;
+        /// Set once a tile could not be written, by whichever thread tried.
+        std::atomic<bool> mFailed;
+
+    public:
+        ImageStream(const std::string file, int width, int height, const ImageEncoder &encoder);
+        ImageStream(const std::string file, int x0, int y0, int width, int height, const ImageEncoder &encoder);
+        ~ImageStream();
+        ImageStream(const ImageStream &) = delete;
+        ImageStream &operator=(const ImageStream &) = delete;
+
+        bool commitTile(const Framebuffer &tile);
+        bool hasFailed() const;
+        uint64_t size() const;
+};
+
+
+bool isLittleEndian();
+ImageFormat getImageFormat(const std::string file);
+std::vector<unsigned char> encodeQoi(const unsigned char *pixels, int width, int height);
+std::vector<unsigned char> encodePng(const unsigned char *pixels, int width, int height, int numThreads);
+size_t writeImage(const std::string file, const Framebuffer &image, const ImageEncoder &encoder, int numThreads);
+bool readImage(const std::string file, int &width, int &height, std::vector<unsigned char> &pixels);
+size_t compositeImage(
+    const std::string file,
+    const std::string background,
+    int fullWidth,
+    int fullHeight,
+    const Framebuffer &image,
+    const ImageEncoder &encoder,
+    int numThreads
+);
+void writeFloatImage(const std::string file, const int width, const int height, const int channels, const float *image);
 
 
 #endif
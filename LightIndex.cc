@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cmath>
+
+#include "LightIndex.h"
+#include "PointLight.h"
+#include "Vector.h"
+
+
+/// The grid has at most MAX_LIGHT_GRID_RESOLUTION cells along each axis.
+#define MAX_LIGHT_GRID_RESOLUTION 32
+/// The grid aims for about this many cells per bounded light.
+#define LIGHT_GRID_CELLS_PER_LIGHT 4
+
+
+LightIndex::LightIndex()
+: mMin({ 0, 0, 0 })
+, mCellSize({ 1, 1, 1 })
+, mResolution{ 0, 0, 0 }
+, mCells()
+, mUnbounded()
+{}
+
+
+/**
+ * Fits the grid around the spheres of influence of the bounded lights and
+ * gives each axis a number of cells in proportion to its length.
+ */
+void LightIndex::build(const std::vector<std::shared_ptr<PointLight>> &lights) {
+    mCells.clear();
+    mUnbounded.clear();
+    std::vector<int> bounded;
+    Vec3f min({ INFINITY, INFINITY, INFINITY });
+    Vec3f max({ -INFINITY, -INFINITY, -INFINITY });
+    for (int i = 0; i < (int) lights.size(); i++) {
+        float radius = lights[i]->mInfluenceRadius;
+        if (radius <= 0) {
+            mUnbounded.push_back(i);
+            continue;
+        }
+        bounded.push_back(i);
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = fmin(min[axis], lights[i]->mPosition[axis] - radius);
+            max[axis] = fmax(max[axis], lights[i]->mPosition[axis] + radius);
+        }
+    }
+
+    if (bounded.empty()) {
+        mResolution[0] = mResolution[1] = mResolution[2] = 0;
+        return;
+    }
+
+    Vec3f extent = subtract(max, min);
+    float longest = fmax(extent[0], fmax(extent[1], extent[2]));
+    float cellsPerAxis = cbrtf(LIGHT_GRID_CELLS_PER_LIGHT * bounded.size());
+    for (int axis = 0; axis < 3; axis++) {
+        int resolution = (int) ceilf(cellsPerAxis * extent[axis] / longest);
+        mResolution[axis] = std::max(1, std::min(MAX_LIGHT_GRID_RESOLUTION, resolution));
+        mCellSize[axis] = extent[axis] / mResolution[axis];
+    }
+    mMin = min;
+    mCells.assign(mResolution[0] * mResolution[1] * mResolution[2], std::vector<int>());
+
+    for (int z = 0; z < mResolution[2]; z++) {
+        for (int y = 0; y < mResolution[1]; y++) {
+            for (int x = 0; x < mResolution[0]; x++) {
+                Vec3f cellMin = add(mMin, Vec3f({ x * mCellSize[0], y * mCellSize[1], z * mCellSize[2] }));
+                Vec3f cellMax = add(cellMin, mCellSize);
+                std::vector<int> &cell = mCells[(z * mResolution[1] + y) * mResolution[0] + x];
+                // Merge the unbounded lights and the bounded lights that
+                // reach this cell back into scene order.
+                size_t u = 0;
+                for (int i : bounded) {
+                    while (u < mUnbounded.size() && mUnbounded[u] < i) {
+                        cell.push_back(mUnbounded[u++]);
+                    }
+                    // The squared distance from the light to the closest
+                    // point of the cell.
+                    float distance = 0;
+                    for (int axis = 0; axis < 3; axis++) {
+                        float p = lights[i]->mPosition[axis];
+                        float d = fmax(0, fmax(cellMin[axis] - p, p - cellMax[axis]));
+                        distance += d * d;
+                    }
+                    float radius = lights[i]->mInfluenceRadius;
+                    if (distance <= radius * radius) {
+                        cell.push_back(i);
+                    }
+                }
+                cell.insert(cell.end(), mUnbounded.begin() + u, mUnbounded.end());
+            }
+        }
+    }
+}
+
+
+const std::vector<int> &LightIndex::query(Vec3f point) const {
+    if (mCells.empty()) {
+        return mUnbounded;
+    }
+
+    int cell[3];
+    for (int axis = 0; axis < 3; axis++) {
+        float offset = (point[axis] - mMin[axis]) / mCellSize[axis];
+        if (!(offset >= 0 && offset <= mResolution[axis])) {
+            return mUnbounded;
+        }
+        cell[axis] = std::min(mResolution[axis] - 1, (int) offset);
+    }
+
+    return mCells[(cell[2] * mResolution[1] + cell[1]) * mResolution[0] + cell[0]];
+}
@@ -0,0 +1,39 @@
+/**
+ * @file
+ * @brief A grid over the scene that lists the lights able to reach each
+ *        cell, so shading only visits the lights that can affect a point.
+ */
+#ifndef _LIGHT_INDEX_H_
+#define _LIGHT_INDEX_H_
+
+#include <memory>
+#include <vector>
+
+#include "PointLight.h"
+#include "Vector.h"
+
+
+/**
+ * Lights with an influence radius are put in every cell their sphere of
+ * influence overlaps. Lights without one reach everywhere and are in every
+ * cell, and are all there is outside the grid. Each cell keeps its lights in
+ * scene order, so that a light is always shaded with the same sample
+ * dimensions wherever it is found.
+ */
+class LightIndex {
+    private:
+        Vec3f mMin;
+        Vec3f mCellSize;
+        int mResolution[3];
+        std::vector<std::vector<int>> mCells;
+        std::vector<int> mUnbounded;
+
+    public:
+        LightIndex();
+        void build(const std::vector<std::shared_ptr<PointLight>> &lights);
+        /// The indices of the lights that may reach `point`.
+        const std::vector<int> &query(Vec3f point) const;
+};
+
+
+#endif
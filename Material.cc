@@ -20,7 +20,7 @@ refractiveIndex(refractiveIndex)
 {}
 
 
-Vec3f Material::getColor(float x, float y, float z) {
+Vec3f Material::getColor(float x, float y, float z, Vec3f footprint) {
     return color;
 }
 
@@ -48,7 +48,43 @@ CheckerboardMaterial::CheckerboardMaterial(
 {}
 
 
-Vec3f CheckerboardMaterial::getColor(float x, float y, float z) {
+/**
+ * The mean of a square wave that is 1 on even squares and -1 on odd squares
+ * over an interval `width` squares wide centered at `t`. The integral of the
+ * square wave is a triangle wave, so the mean is the difference of the
+ * triangle wave at either end of the interval over its width.
+ */
+float filteredSquareWave(float t, float width) {
+    auto integral = [](float u) {
+        return 1 - fabs(u - 2 * floor(u / 2) - 1);
+    };
+    return (integral(t + width / 2) - integral(t - width / 2)) / width;
+}
+
+
+/**
+ * When there is a footprint, the pattern is box filtered analytically. The
+ * checkerboard is the product of one square wave along each axis, and a box
+ * filter is a product along each axis too, so the filtered pattern is the
+ * product of the filtered square waves. The result blends from the checkers
+ * to the average of both colors as the footprint covers more of them.
+ */
+Vec3f CheckerboardMaterial::getColor(float x, float y, float z, Vec3f footprint) {
+    if (footprint[0] > 0 || footprint[1] > 0 || footprint[2] > 0) {
+        float p[] = { x, y, z };
+        float parity = 1;
+        for (int i = 0; i < 3; i++) {
+            float width = footprint[i] / size;
+            if (width > 1e-4) {
+                parity *= filteredSquareWave(p[i] / size, width);
+            } else {
+                parity *= ((int) floor(p[i] / size)) % 2 == 0 ? 1 : -1;
+            }
+        }
+        parity = fmax(-1, fmin(1, parity));
+        return add(multiply(color, (1 + parity) / 2), multiply(oddColor, (1 - parity) / 2));
+    }
+
     int k = (
         (int) floor(x / size) +
         (int) floor(y / size) +
@@ -28,7 +28,11 @@ class Material {
         );
         virtual ~Material() = default;
 
-        virtual Vec3f getColor(float x, float y, float z);
+        /**
+         * The color at (x, y, z), averaged over a box around it that is
+         * `footprint` wide along each axis. A zero footprint is a point.
+         */
+        virtual Vec3f getColor(float x, float y, float z, Vec3f footprint);
 };
 
 
@@ -48,7 +52,7 @@ class CheckerboardMaterial : public Material {
             float size
         );
 
-        Vec3f getColor(float x, float y, float z);
+        Vec3f getColor(float x, float y, float z, Vec3f footprint);
 };
 
 
@@ -0,0 +1,95 @@
+#ifdef __linux__
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Numa.h"
+
+
+/**
+ * Parse a sysfs CPU list such as `0-3,8-11` into the CPUs it names.
+ */
+std::vector<int> parseCpuList(std::string list) {
+    std::vector<int> cpus;
+    std::string::size_type start = 0;
+    while (start < list.size()) {
+        std::string::size_type end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string range = list.substr(start, end - start);
+        std::string::size_type dash = range.find('-');
+        try {
+            if (dash == std::string::npos) {
+                cpus.push_back(std::stoi(range));
+            } else {
+                int first = std::stoi(range.substr(0, dash));
+                int last = std::stoi(range.substr(dash + 1));
+                for (int cpu = first; cpu <= last; cpu++) {
+                    cpus.push_back(cpu);
+                }
+            }
+        } catch (...) {
+            // Ignore anything unparseable, such as a trailing newline.
+        }
+        start = end + 1;
+    }
+
+    return cpus;
+}
+
+
+/**
+ * Returns the CPUs belonging to each NUMA node, read from sysfs. Machines
+ * without NUMA (or that aren't running Linux) report a single node holding
+ * every CPU.
+ */
+std::vector<std::vector<int>> getNumaNodeCpus() {
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0; ; node++) {
+        std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!f.is_open()) {
+            break;
+        }
+
+        std::string list;
+        std::getline(f, list);
+        std::vector<int> cpus = parseCpuList(list);
+        // Memory-only nodes have no CPUs to run render threads on.
+        if (!cpus.empty()) {
+            nodes.push_back(cpus);
+        }
+    }
+
+    if (nodes.empty()) {
+        std::vector<int> cpus;
+        int count = std::max(1u, std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < count; cpu++) {
+            cpus.push_back(cpu);
+        }
+        nodes.push_back(cpus);
+    }
+
+    return nodes;
+}
+
+
+/**
+ * Pin the calling thread to a single CPU so that the memory it first touches
+ * stays local to it. Returns false if pinning is unsupported or failed.
+ */
+bool bindCurrentThreadToCpu(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,15 @@
+/**
+ * @file
+ * @brief Discover the NUMA topology of the machine and pin threads to CPUs.
+ */
+#ifndef _NUMA_H_
+#define _NUMA_H_
+
+#include <vector>
+
+
+std::vector<std::vector<int>> getNumaNodeCpus();
+bool bindCurrentThreadToCpu(int cpu);
+
+
+#endif
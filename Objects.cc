@@ -1,12 +1,3 @@
-#ifdef __APPLE__
-#  include <OpenGL/gl.h>
-#  include <OpenGL/glu.h>
-#  include <GLUT/glut.h>
-#else
-#  include <GL/gl.h>
-#  include <GL/glu.h>
-#  include <GL/freeglut.h>
-#endif
 #include <cmath>
 
 #include "Objects.h"
@@ -18,8 +9,8 @@ SceneObject::SceneObject(std::shared_ptr<Material> material)
 {}
 
 
-Vec3f SceneObject::getColor(float x, float y, float z) {
-    return mMaterial->getColor(x, y, z);
+Vec3f SceneObject::getColor(float x, float y, float z, Vec3f footprint) {
+    return mMaterial->getColor(x, y, z, footprint);
 }
 
 
@@ -71,15 +62,24 @@ Vec3f Sphere::getNormalDir(Vec3f intersection) {
 
 /**
  * Perform some texture mapping so that we can use the CheckerboardMaterial
- * without it being distorted.
+ * without it being distorted. The footprint is mapped too: the widest extent
+ * of the footprint is an arc of the sphere, which covers more of u around
+ * the poles where the circles of latitude are small.
  */
-Vec3f Sphere::getColor(float x, float y, float z) {
+Vec3f Sphere::getColor(float x, float y, float z, Vec3f footprint) {
     // Based on [9].
     float theta = atan2(-(z - mOrigin[2]), x - mOrigin[0]);
     float u = (theta + M_PI) / (2.0f * M_PI);
     float phi = acos(-(y - mOrigin[1]) / mRadius);
     float v = phi / M_PI;
-    return mMaterial->getColor(u, v, 0);
+
+    float width = fmax(footprint[0], fmax(footprint[1], footprint[2]));
+    Vec3f uvFootprint({ 0, 0, 0 });
+    if (width > 0) {
+        uvFootprint[0] = fmin(1, width / (2 * M_PI * mRadius * fmax(1e-3, sinf(phi))));
+        uvFootprint[1] = fmin(1, width / (M_PI * mRadius));
+    }
+    return mMaterial->getColor(u, v, 0, uvFootprint);
 }
 
 
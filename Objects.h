@@ -24,7 +24,7 @@ class SceneObject {
             float &intersectionScalar
         ) = 0;
         virtual Vec3f getNormalDir(Vec3f intersection) = 0;
-        virtual Vec3f getColor(float x, float y, float z);
+        virtual Vec3f getColor(float x, float y, float z, Vec3f footprint);
 };
 
 
@@ -44,7 +44,7 @@ class Sphere : public SceneObject {
             float &intersectionScalar
         );
         Vec3f getNormalDir(Vec3f intersection);
-        Vec3f getColor(float x, float y, float z);
+        Vec3f getColor(float x, float y, float z, Vec3f footprint);
 };
 
 
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "Framebuffer.h"
+#include "ImageFile.h"
+#include "Partial.h"
+#include "Renderer.h"
+#include "Vector.h"
+
+
+/// The first line of every partial image, which changes with the format.
+#define PARTIAL_MAGIC "RAYPART 1"
+
+
+/// Where part `part` of an image that would go to `outputFile` is written.
+std::string getPartialFile(const std::string outputFile, int part) {
+    return outputFile + ".part" + std::to_string(part);
+}
+
+
+/**
+ * The tiles part `part` of `numParts` renders. Tiles are dealt out in turn,
+ * so every part gets tiles from all over the image and about the same share
+ * of the expensive ones, and every machine deals them out the same way.
+ */
+std::vector<Tile> selectPartTiles(const std::vector<Tile> &tiles, int part, int numParts) {
+    std::vector<Tile> selected;
+    for (size_t i = part; i < tiles.size(); i += numParts) {
+        selected.push_back(tiles[i]);
+    }
+    return selected;
+}
+
+
+/**
+ * Write the pixels of `header.tiles` from `image` to a partial image: a text
+ * header, then the float RGB pixels of each tile in turn, row by row, in the
+ * byte order named in the header. The floats are the ones that would have
+ * been encoded, so nothing is lost before the parts are merged. Returns the
+ * size of the file in bytes, or zero if it could not be written.
+ */
+size_t writePartialImage(const std::string file, const PartialHeader &header, const Framebuffer &image) {
+    std::ofstream partial(file, std::ios::out | std::ios::binary);
+    // Enough digits for the gamma to read back as the same float.
+    partial << std::setprecision(std::numeric_limits<float>::max_digits10);
+    partial << PARTIAL_MAGIC << "\n"
+            << header.width << " " << header.height << "\n"
+            << header.region.x0 << " " << header.region.y0 << " " << header.region.x1 << " " << header.region.y1 << "\n"
+            << header.part << " " << header.numParts << "\n"
+            << header.gamma << " " << (header.dither ? 1 : 0) << "\n"
+            << header.tiles.size() << "\n";
+    for (const Tile &tile : header.tiles) {
+        partial << tile.x0 << " " << tile.y0 << " " << tile.x1 << " " << tile.y1 << "\n";
+    }
+    partial << (isLittleEndian() ? "little" : "big") << "\n";
+
+    std::vector<Vec3f> row;
+    for (const Tile &tile : header.tiles) {
+        row.resize(tile.x1 - tile.x0 + 1);
+        for (int y = tile.y0; y <= tile.y1; y++) {
+            for (int x = tile.x0; x <= tile.x1; x++) {
+                row[x - tile.x0] = image.get(x, y);
+            }
+            partial.write((const char *) row.data(), row.size() * sizeof(Vec3f));
+        }
+    }
+    if (!partial) {
+        return 0;
+    }
+    return (size_t) partial.tellp();
+}
+
+
+/**
+ * Read a partial image written by writePartialImage into its header and the
+ * pixels of its tiles, one after another. Returns false, and says why, if it
+ * can't be read or its header doesn't describe a possible render.
+ */
+bool readPartialImage(const std::string file, PartialHeader &header, std::vector<Vec3f> &pixels) {
+    std::ifstream partial(file, std::ios::in | std::ios::binary);
+    std::string magic;
+    std::getline(partial, magic);
+    if (magic != PARTIAL_MAGIC) {
+        std::cout << file << " is not a partial image." << std::endl;
+        return false;
+    }
+
+    int dither = 0;
+    size_t numTiles = 0;
+    partial >> header.width >> header.height
+            >> header.region.x0 >> header.region.y0 >> header.region.x1 >> header.region.y1
+            >> header.part >> header.numParts
+            >> header.gamma >> dither
+            >> numTiles;
+    header.dither = dither != 0;
+    // Check the header before sizing anything by it, so that a corrupt file
+    // is reported rather than taken at its word.
+    const Tile &region = header.region;
+    size_t regionArea = (size_t) std::max(0, region.x1 - region.x0 + 1) * std::max(0, region.y1 - region.y0 + 1);
+    if (!partial || header.width < 1 || header.height < 1
+            || region.x0 < 0 || region.x0 > region.x1 || region.x1 >= header.width
+            || region.y0 < 0 || region.y0 > region.y1 || region.y1 >= header.height
+            || header.numParts < 1 || (size_t) header.numParts > regionArea
+            || header.part < 0 || header.part >= header.numParts
+            || numTiles > regionArea) {
+        std::cout << "The header of " << file << " is corrupt." << std::endl;
+        return false;
+    }
+    header.tiles.clear();
+    size_t numPixels = 0;
+    for (size_t i = 0; i < numTiles && partial; i++) {
+        Tile tile = { 0, 0, 0, 0, 0, false };
+        partial >> tile.x0 >> tile.y0 >> tile.x1 >> tile.y1;
+        if (tile.x0 < region.x0 || tile.x0 > tile.x1 || tile.x1 > region.x1
+                || tile.y0 < region.y0 || tile.y0 > tile.y1 || tile.y1 > region.y1) {
+            std::cout << file << " has a tile outside the image." << std::endl;
+            return false;
+        }
+        header.tiles.push_back(tile);
+        numPixels += tile.area();
+    }
+    if (numPixels > regionArea) {
+        std::cout << file << " has more pixels than the image." << std::endl;
+        return false;
+    }
+    std::string byteOrder;
+    partial >> byteOrder;
+    partial.get();
+    if (!partial || byteOrder != (isLittleEndian() ? "little" : "big")) {
+        std::cout << "Could not read the header of " << file << ", or it was written with another byte order." << std::endl;
+        return false;
+    }
+
+    pixels.resize(numPixels);
+    partial.read((char *) pixels.data(), numPixels * sizeof(Vec3f));
+    if ((size_t) partial.gcount() != numPixels * sizeof(Vec3f)) {
+        std::cout << file << " is missing pixels." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Put the partial images in `files` together and write the whole image to
+ * `outputFile` with writeImage, encoded the way the parts say the render
+ * asked for. Every part must be of the same render, and between them they
+ * must cover every pixel of its region exactly once. Returns false, and says
+ * what is wrong, otherwise.
+ */
+bool mergePartialImages(const std::vector<std::string> &files, const std::string outputFile, int numThreads) {
+    if (files.empty()) {
+        std::cout << "There are no partial images to merge." << std::endl;
+        return false;
+    }
+
+    PartialHeader first;
+    Framebuffer *image = NULL;
+    std::vector<char> isCovered;
+    std::vector<char> isPartRead;
+    bool isValid = true;
+    for (size_t i = 0; i < files.size() && isValid; i++) {
+        PartialHeader header;
+        std::vector<Vec3f> pixels;
+        if (!readPartialImage(files[i], header, pixels)) {
+            isValid = false;
+            break;
+        }
+        if (i == 0) {
+            first = header;
+            int regionWidth = header.region.x1 - header.region.x0 + 1;
+            int regionHeight = header.region.y1 - header.region.y0 + 1;
+            image = new Framebuffer(header.region.x0, header.region.y0, regionWidth, regionHeight, false, FLOAT_RGB);
+            isCovered.assign((size_t) regionWidth * regionHeight, false);
+            isPartRead.assign(header.numParts, false);
+        }
+        if (header.width != first.width || header.height != first.height
+                || header.region.x0 != first.region.x0 || header.region.y0 != first.region.y0
+                || header.region.x1 != first.region.x1 || header.region.y1 != first.region.y1
+                || header.numParts != first.numParts || header.gamma != first.gamma || header.dither != first.dither) {
+            std::cout << files[i] << " is part of a different render than " << files[0] << "." << std::endl;
+            isValid = false;
+            break;
+        }
+        if (header.part < 0 || header.part >= header.numParts || isPartRead[header.part]) {
+            std::cout << files[i] << " is part " << header.part << " of " << header.numParts << ", which is out of range or already merged." << std::endl;
+            isValid = false;
+            break;
+        }
+        isPartRead[header.part] = true;
+
+        const Vec3f *pixel = pixels.data();
+        // readPartialImage has checked the tiles are inside the region, which
+        // is the same for every part.
+        for (const Tile &tile : header.tiles) {
+            for (int y = tile.y0; y <= tile.y1; y++) {
+                for (int x = tile.x0; x <= tile.x1; x++) {
+                    size_t index = image->index(x, y);
+                    if (isCovered[index]) {
+                        std::cout << "Pixel " << x << ", " << y << " is in more than one part." << std::endl;
+                        isValid = false;
+                    }
+                    isCovered[index] = true;
+                    image->set(x, y, *pixel++);
+                }
+            }
+        }
+    }
+
+    if (isValid) {
+        for (int part = 0; part < first.numParts; part++) {
+            if (!isPartRead[part]) {
+                std::cout << "Part " << part << " of " << first.numParts << " is missing." << std::endl;
+                isValid = false;
+            }
+        }
+    }
+    if (isValid) {
+        for (char covered : isCovered) {
+            if (!covered) {
+                std::cout << "The parts do not cover every pixel." << std::endl;
+                isValid = false;
+                break;
+            }
+        }
+    }
+    if (isValid) {
+        writeImage(outputFile, *image, ImageEncoder(first.gamma, first.dither), numThreads);
+    }
+    delete image;
+    return isValid;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file
+ * @brief Reads and writes partial images, the tiles of a frame one machine of
+ *        several rendered, and merges them into the whole image.
+ */
+#ifndef _PARTIAL_H_
+#define _PARTIAL_H_
+
+#include <string>
+#include <vector>
+
+#include "Framebuffer.h"
+#include "Renderer.h"
+#include "Vector.h"
+
+
+/**
+ * What a partial image covers, and what the whole image it is part of needs
+ * to be written the way a single machine would have written it.
+ */
+struct PartialHeader {
+    /// The size of the whole image.
+    int width;
+    int height;
+    /// The pixels the render covered between all of its parts: the crop
+    /// window, or the whole image.
+    Tile region;
+    /// Which of how many parts this is.
+    int part;
+    int numParts;
+    float gamma;
+    bool dither;
+    /// The tiles this part rendered, in the order their pixels are stored.
+    std::vector<Tile> tiles;
+};
+
+
+std::string getPartialFile(const std::string outputFile, int part);
+std::vector<Tile> selectPartTiles(const std::vector<Tile> &tiles, int part, int numParts);
+size_t writePartialImage(const std::string file, const PartialHeader &header, const Framebuffer &image);
+bool readPartialImage(const std::string file, PartialHeader &header, std::vector<Vec3f> &pixels);
+bool mergePartialImages(const std::vector<std::string> &files, const std::string outputFile, int numThreads);
+
+
+#endif
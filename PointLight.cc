@@ -1,13 +1,14 @@
 #include <cmath>
 
 #include "PointLight.h"
-#include "Utility.h"
 
 
 PointLight::PointLight(Vec3f position, float intensity, float radius)
 : mPosition(position)
 , mIntensity(intensity)
 , mRadius(radius)
+, mShadowSamples(1)
+, mInfluenceRadius(0)
 {}
 
 
@@ -20,17 +21,64 @@ PointLight::PointLight(Vec3f position, float intensity, float radius)
  * PointLight.
  *
  * @param useSoftShadows Jitter the light within the radius if enabled.
+ * @param sample A point in the unit cube that places the jittered light. It
+ *        is mapped to a uniformly distributed point in the light's sphere.
  */
-Vec3f PointLight::direction(Vec3f intersection, float &distance, bool useSoftShadows) {
+Vec3f PointLight::direction(Vec3f intersection, float &distance, bool useSoftShadows, Vec3f sample) {
     Vec3f pos = mPosition;
     if (useSoftShadows) {
         // Technique from [10].
         // We can have soft shadows by faking a non-point volume light. This is
         // achieved by randomly jittering the light. This will introduce noise.
-        pos = add(pos, multiply(randomVec3f(), mRadius));
+        // The first two dimensions pick a direction and the cube root of the
+        // third a distance, so that points are spread evenly by volume.
+        float z = 1 - 2 * sample[0];
+        float phi = 2 * M_PI * sample[1];
+        float r = sqrtf(fmax(0, 1 - z * z));
+        Vec3f offset({ r * cosf(phi), r * sinf(phi), z });
+        pos = add(pos, multiply(offset, mRadius * cbrtf(sample[2])));
     }
     Vec3f i = subtract(pos, intersection);
 
     distance = sqrtf(dot(i, i));
     return normalize(i);
 }
+
+
+/**
+ * Like `direction`, but towards a point on the outline of the light as seen
+ * from `intersection`, which is where the light starts to be hidden by an
+ * occluder.
+ *
+ * @param angle The position around the outline, as a fraction of a turn.
+ */
+Vec3f PointLight::silhouetteDirection(Vec3f intersection, float &distance, float angle) {
+    Vec3f w = normalize(subtract(mPosition, intersection));
+    // Any vector not parallel to w gives a basis for the plane facing it.
+    Vec3f a = fabs(w[0]) > 0.9f ? Vec3f({ 0, 1, 0 }) : Vec3f({ 1, 0, 0 });
+    Vec3f u = normalize(crossProduct(w, a));
+    Vec3f v = crossProduct(w, u);
+
+    float phi = 2 * M_PI * angle;
+    Vec3f pos = add(mPosition, multiply(add(multiply(u, cosf(phi)), multiply(v, sinf(phi))), mRadius));
+    Vec3f i = subtract(pos, intersection);
+
+    distance = sqrtf(dot(i, i));
+    return normalize(i);
+}
+
+
+/**
+ * Whether this light can light `point` at all: it has to be within the
+ * light's influence radius, and some of the light has to be in front of the
+ * surface. The whole light is a single point without soft shadows.
+ */
+bool PointLight::reaches(Vec3f point, Vec3f normal, bool useSoftShadows) {
+    Vec3f toLight = subtract(mPosition, point);
+    if (mInfluenceRadius > 0 && dot(toLight, toLight) > mInfluenceRadius * mInfluenceRadius) {
+        return false;
+    }
+
+    float radius = useSoftShadows ? mRadius : 0;
+    return dot(toLight, normal) + radius > 0;
+}
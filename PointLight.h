@@ -21,9 +21,22 @@ class PointLight {
          *        not matter if soft shadows are turned off.
          */
         float mRadius;
+        /**
+         * @brief The number of shadow rays traced to this light at each
+         *        point that is shaded, when soft shadows are on.
+         */
+        int mShadowSamples;
+        /**
+         * @brief Points further than this from the light are not lit by it,
+         *        so shading can skip it. Zero means the light reaches
+         *        everywhere.
+         */
+        float mInfluenceRadius;
 
         PointLight(Vec3f position, float intensity, float radius);
-        Vec3f direction(Vec3f intersection, float &distance, bool useSoftShadows);
+        Vec3f direction(Vec3f intersection, float &distance, bool useSoftShadows, Vec3f sample);
+        Vec3f silhouetteDirection(Vec3f intersection, float &distance, float angle);
+        bool reaches(Vec3f point, Vec3f normal, bool useSoftShadows);
 };
 
 
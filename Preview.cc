@@ -0,0 +1,87 @@
+#ifdef __APPLE__
+#  include <OpenGL/gl.h>
+#  include <OpenGL/glu.h>
+#  include <GLUT/glut.h>
+#else
+#  include <GL/gl.h>
+#  include <GL/glu.h>
+#  include <GL/freeglut.h>
+#endif
+#include <vector>
+
+#include "ImageFile.h"
+#include "Preview.h"
+#include "Renderer.h"
+#include "Vector.h"
+
+
+/// Needs the GL context of the window to be current.
+Preview::Preview(Renderer &renderer)
+: mRenderer(renderer)
+, mEncoder(renderer.mGamma, renderer.mEnableDither)
+, mTexture(0)
+, mPixels()
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    mTexture = texture;
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // Black until the first tiles come in.
+    std::vector<unsigned char> black((size_t) renderer.mWidth * renderer.mHeight * 3, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, renderer.mWidth, renderer.mHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, black.data());
+}
+
+
+Preview::~Preview() {
+    GLuint texture = mTexture;
+    glDeleteTextures(1, &texture);
+}
+
+
+/**
+ * Upload the tiles finished since the last update into the texture. Returns
+ * true if there were any, in which case the window needs redrawing.
+ */
+bool Preview::update() {
+    std::vector<TileSnapshot> tiles = mRenderer.takeFinishedTiles();
+    if (tiles.empty()) {
+        return false;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+    for (const TileSnapshot &snapshot : tiles) {
+        const Tile &tile = snapshot.tile;
+        int width = tile.x1 - tile.x0 + 1;
+        mPixels.resize((size_t) width * (tile.y1 - tile.y0 + 1) * 3);
+        for (int y = tile.y0; y <= tile.y1; y++) {
+            size_t offset = (size_t) (y - tile.y0) * width;
+            mEncoder.encode(&snapshot.pixels[offset], width, tile.x0, y, &mPixels[offset * 3]);
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, tile.x0, tile.y0, width, tile.y1 - tile.y0 + 1, GL_RGB, GL_UNSIGNED_BYTE, mPixels.data());
+    }
+    return true;
+}
+
+
+/// Draw the texture over the image's place in the window, top row first.
+void Preview::draw() {
+    int width = mRenderer.mWidth;
+    int height = mRenderer.mHeight;
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0);
+    glVertex2i(0, height);
+    glTexCoord2f(1, 0);
+    glVertex2i(width, height);
+    glTexCoord2f(1, 1);
+    glVertex2i(width, 0);
+    glTexCoord2f(0, 1);
+    glVertex2i(0, 0);
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
+}
@@ -0,0 +1,43 @@
+/**
+ * @file
+ * @brief Shows the image in the GLUT window while it renders. This is the
+ *        only code besides main.cc that needs OpenGL, so the headless binary
+ *        and the library leave it out.
+ */
+#ifndef _PREVIEW_H_
+#define _PREVIEW_H_
+
+#include <vector>
+
+#include "ImageFile.h"
+#include "Renderer.h"
+#include "Vector.h"
+
+
+/// How often the preview uploads the tiles finished since it last looked.
+#define PREVIEW_INTERVAL_MS 250
+
+
+/**
+ * Keeps the image in a texture and draws it as a single quad. Only copies of
+ * the tiles the render threads have finished since the last update are
+ * encoded and uploaded, on the GLUT thread, so the render threads never wait
+ * on it.
+ */
+class Preview {
+    private:
+        Renderer &mRenderer;
+        /// Encodes pixels the same way the output file is encoded.
+        ImageEncoder mEncoder;
+        unsigned int mTexture;
+        std::vector<unsigned char> mPixels;
+
+    public:
+        Preview(Renderer &renderer);
+        ~Preview();
+        bool update();
+        void draw();
+};
+
+
+#endif
@@ -0,0 +1,45 @@
+#include <cstdint>
+
+#include "Random.h"
+
+
+/// The finalizer of SplitMix64, used to spread nearby seeds far apart.
+uint64_t mixBits(uint64_t v) {
+    v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+    return v ^ (v >> 31);
+}
+
+
+Random::Random()
+: mState(0x853c49e6748fea9bULL)
+, mIncrement(0xda3e39cb94b95bdbULL)
+{}
+
+
+/**
+ * Every pixel gets its own PCG stream, and every (sample, iteration) pair of
+ * that pixel starts at a different point along the stream.
+ */
+void Random::seed(uint64_t pixel, uint32_t sample, uint32_t iteration) {
+    mState = 0;
+    mIncrement = (mixBits(pixel) << 1u) | 1u;
+    nextUInt();
+    mState += mixBits(((uint64_t) iteration << 32) | sample);
+    nextUInt();
+}
+
+
+uint32_t Random::nextUInt() {
+    uint64_t oldState = mState;
+    mState = oldState * 6364136223846793005ULL + mIncrement;
+    uint32_t xorShifted = (uint32_t) (((oldState >> 18u) ^ oldState) >> 27u);
+    uint32_t rotation = (uint32_t) (oldState >> 59u);
+    return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+}
+
+
+float Random::nextFloat() {
+    // The top 24 bits fill a float mantissa exactly.
+    return (nextUInt() >> 8) * (1.0f / 16777216.0f);
+}
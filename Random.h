@@ -0,0 +1,34 @@
+/**
+ * @file
+ * @brief A small PCG32 random number generator. Every render thread owns its
+ *        own instance so that sampling never contends on shared state.
+ */
+#ifndef _RANDOM_H_
+#define _RANDOM_H_
+
+#include <cstdint>
+
+
+/**
+ * Based on [11]. The generator is reseeded for every sample from the pixel,
+ * sample, and iteration being rendered, so an image comes out the same no
+ * matter how many threads render it or in what order the tiles are taken.
+ */
+class Random {
+    private:
+        uint64_t mState;
+        uint64_t mIncrement;
+
+    public:
+        Random();
+        void seed(uint64_t pixel, uint32_t sample, uint32_t iteration);
+        uint32_t nextUInt();
+        /// Uniformly distributed in [0, 1).
+        float nextFloat();
+};
+
+
+uint64_t mixBits(uint64_t v);
+
+
+#endif
@@ -1,37 +1,112 @@
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <iostream>
 #include <iomanip>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
 #include <utility>
 
+#include "Framebuffer.h"
 #include "ImageFile.h"
+#include "Numa.h"
+#include "Partial.h"
 #include "Renderer.h"
 #include "Utility.h"
 #include "Vector.h"
 
 
-#define WORK_BLOCK_SIZE 4
+/// Render jobs are square tiles of at most TILE_SIZE by TILE_SIZE pixels.
+#define TILE_SIZE 32
+/// The cost pre-pass traces one ray per PREPASS_STRIDE by PREPASS_STRIDE pixels.
+#define PREPASS_STRIDE 8
+/// A tile costing more than 1 / TILE_SPLIT_SHARE of a thread's share is split.
+#define TILE_SPLIT_SHARE 8
+/// Tiles are never split below MIN_TILE_SIZE pixels on a side, and only
+/// along the lines of a MIN_TILE_SIZE grid.
+#define MIN_TILE_SIZE 8
+/// Adaptive anti-aliasing starts every pixel with this many samples.
+#define ADAPTIVE_INITIAL_SAMPLES 4
+/// Progressive pixels are not tested for convergence before this many samples.
+#define MIN_CONVERGENCE_SAMPLES 4
+/// Each light sample picks its light out of this many candidates.
+#define LIGHT_CANDIDATES 8
+/// A time budgeted pass gives no pixel more than this many samples.
+#define MAX_SAMPLES_PER_PASS 4
+/// Pixels blurred over a circle of this radius in pixels get every iteration.
+#define FULL_DEPTH_OF_FIELD_BLUR 4.0f
+
+
+int Tile::area() const {
+    return (x1 - x0 + 1) * (y1 - y0 + 1);
+}
 
 
 Renderer::Renderer(Scene &scene)
-: mWorkQueue()
+: mWorkQueues()
 , mQueueLock()
-, mCompletedRows(0)
+, mCompletedPixels(0)
+, mQueuedPixels(0)
 , mImage(NULL)
+, mNumaNodeCpus()
+, mSampleCounts()
+, mSumSquares()
+, mConverged()
+, mMeanStandardError(0)
+, mDeadline()
+, mRegion()
+, mFinishedTiles()
+, mPreviewLock()
 , mScene(scene)
+, mTiles()
 , mWidth(600)
 , mHeight(500)
+, mEnableCrop(false)
+, mCropX0(0)
+, mCropY0(0)
+, mCropX1(0)
+, mCropY1(0)
+, mCompositeFile()
+, mPart(0)
+, mNumParts(1)
 , mNoiseReduction(1)
+, mConvergenceThreshold(0)
+, mTimeBudgetSeconds(0)
+, mPass(0)
 , mMaxDepth(3)
 , mAntiAliasing(0)
-, mAntiAliasingMethod(REGULAR)
+, mEnableAdaptiveAntiAliasing(false)
+, mContrastThreshold(0.1f)
+, mSamplingMethod(REGULAR)
 , mEnableSoftShadows(false)
+, mEnableTextureFiltering(false)
+, mEnableAdaptiveShadows(false)
+, mEnableAdaptiveDepthOfField(false)
+, mShadowProbes(4)
+, mLightSamples(0)
+, mLightTable()
+, mLightIndex()
+, mEnablePrimaryHitCache(true)
+, mCachePrimaryHits(false)
+, mEnableDenoising(false)
+, mDenoiser(NULL)
+, mAovChannels()
+, mAovs(NULL)
+, mEnableCostPrePass(false)
+, mEnableNumaPlacement(false)
+, mEnableHugePages(false)
 , mNumThreads(1)
 , mOutputFile("./Ray.ppm")
+, mFramebufferFormat(FLOAT_RGB)
+, mEnableStreamingOutput(false)
+, mStream(NULL)
+, mGamma(1)
+, mEnableDither(false)
+, mIsHeadless(false)
+, mEnablePreview(false)
 {
     int s = (int) sqrtf(mAntiAliasing);
     if (s * s != mAntiAliasing) {
@@ -41,85 +116,661 @@ Renderer::Renderer(Scene &scene)
 
 
 Renderer::~Renderer() {
-    delete [] mImage;
+    delete mImage;
+    delete mDenoiser;
+    delete mAovs;
+    delete mStream;
 }
 
 
 /**
- * Pushes blocks of rows on to a queue and starts render threads which will pop
- * off the queue and render independent rows.
+ * Divides the image into tiles, pushes them on to a queue, and starts render
+ * threads which will pop off the queue and render independent tiles.
  */
 void Renderer::render() {
-    mImage = new Vec3f[mHeight * mWidth];
+    mRegion = Tile{ 0, 0, mWidth - 1, mHeight - 1, 0, false };
+    if (mEnableCrop) {
+        mRegion = Tile{
+            std::max(0, mCropX0),
+            std::max(0, mCropY0),
+            std::min(mWidth - 1, mCropX1),
+            std::min(mHeight - 1, mCropY1),
+            0,
+            false
+        };
+        if (mRegion.x0 > mRegion.x1 || mRegion.y0 > mRegion.y1) {
+            std::cout << "The crop window is outside the image, there is nothing to render" << std::endl;
+            return;
+        }
+    }
+    int regionWidth = mRegion.x1 - mRegion.x0 + 1;
+    int regionHeight = mRegion.y1 - mRegion.y0 + 1;
+    bool isCompositing = mEnableCrop && !mCompositeFile.empty();
+    if (mEnableStreamingOutput && isCompositing) {
+        std::cout << "Compositing a crop needs it in memory, turning streaming output off" << std::endl;
+        mEnableStreamingOutput = false;
+    }
+    // A part only has some of the tiles, so nothing can look past them.
+    if (mNumParts > 1 && (mEnableStreamingOutput || mEnableDenoising || !mAovChannels.empty() || isCompositing)) {
+        std::cout << "Rendering part of the tiles writes a partial image, turning off streaming, denoising, AOVs and compositing" << std::endl;
+        mEnableStreamingOutput = false;
+        mEnableDenoising = false;
+        mAovChannels.clear();
+        isCompositing = false;
+    }
+    // Streaming writes tiles out as they finish, which only works when each
+    // tile is finished in one pass and nothing needs the whole image after.
+    if (mEnableStreamingOutput && (isProgressive() || mEnableDenoising || !mAovChannels.empty())) {
+        std::cout << "Streaming output needs a single pass without denoising or AOVs, turning it off" << std::endl;
+        mEnableStreamingOutput = false;
+    }
+    // Compressed formats can't have a tile written into the middle of them.
+    if (mEnableStreamingOutput && getImageFormat(mOutputFile) != PPM) {
+        std::cout << "Streaming output needs a PPM output file, turning it off" << std::endl;
+        mEnableStreamingOutput = false;
+    }
+    if (mEnableStreamingOutput) {
+        mStream = new ImageStream(mOutputFile, mRegion.x0, mRegion.y0, regionWidth, regionHeight, ImageEncoder(mGamma, mEnableDither));
+    } else {
+        // A progressive render keeps running means in the image, which have
+        // to stay exact from one pass to the next.
+        FramebufferFormat format = mFramebufferFormat;
+        if (format != FLOAT_RGB && isProgressive()) {
+            std::cout << "Progressive rendering needs a float framebuffer, using one" << std::endl;
+            format = FLOAT_RGB;
+        }
+        mImage = new Framebuffer(mRegion.x0, mRegion.y0, regionWidth, regionHeight, mEnableHugePages, format);
+    }
+    if (mEnableDenoising) {
+        mDenoiser = new Denoiser(mRegion.x0, mRegion.y0, regionWidth, regionHeight);
+    }
+    if (!mAovChannels.empty()) {
+        mAovs = new Aovs(mRegion.x0, mRegion.y0, regionWidth, regionHeight, mAovChannels, mScene.mObjects);
+    }
+    if (mEnableNumaPlacement) {
+        mNumaNodeCpus = getNumaNodeCpus();
+    } else {
+        mNumaNodeCpus.assign(1, std::vector<int>());
+    }
+    mWorkQueues.assign(mNumaNodeCpus.size(), std::queue<int>());
     // Compute properties shared by all primary ray computations in all threads.
     float aspectRatio = (float) mWidth / (float) mHeight;
     float fovRatio = tan(mScene.mCamera.mFieldOfViewRadians / 2.0f);
 
-    // Divide the rows of the image into blocks and place them in the work
-    // queue.
+    // A progressive render takes one sample of every pixel that has yet to
+    // converge per pass, otherwise a single pass renders every iteration. A
+    // time budgeted render keeps going until it runs out of time.
+    bool progressive = isProgressive();
+    int numPasses = 1;
+    if (mTimeBudgetSeconds > 0) {
+        numPasses = std::numeric_limits<int>::max();
+    } else if (progressive) {
+        numPasses = getIterations();
+    }
+    mCachePrimaryHits = shouldCachePrimaryHits();
+    std::vector<float> lightWeights;
+    for (auto light : mScene.mPointLights) {
+        lightWeights.push_back(fmax(0, light->mIntensity));
+    }
+    mLightTable.build(lightWeights);
+    mLightIndex.build(mScene.mPointLights);
+    if (getIterations() < mNoiseReduction) {
+        std::cout << "Nothing is stochastic, rendering a single iteration" << std::endl;
+    }
+    if (progressive) {
+        size_t numPixels = (size_t) regionWidth * regionHeight;
+        mSampleCounts.assign(numPixels, 0);
+        mSumSquares.assign(numPixels, 0);
+        mConverged.assign(numPixels, false);
+    }
+
+    buildTiles();
+    std::vector<Tile> partTiles;
+    if (mNumParts > 1) {
+        mTiles = selectPartTiles(mTiles, mPart, mNumParts);
+        partTiles = mTiles;
+    }
+    if (mEnableCostPrePass) {
+        estimateTileCosts(aspectRatio, fovRatio);
+        balanceTiles();
+    }
+
+    TimePoint startTime = Clock::now();
+    mDeadline = startTime + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(mTimeBudgetSeconds)
+    );
+    std::vector<std::shared_ptr<RenderThread>> threads;
+    for (int i = 0; i < mNumThreads; i++) {
+        threads.push_back(std::shared_ptr<RenderThread>(new RenderThread(this, aspectRatio, fovRatio)));
+    }
+    if (mEnableNumaPlacement && mImage != NULL) {
+        // Every share is touched before any thread renders, as a late touch
+        // would clear a tile another thread of the node had already written.
+        for (int i = 0; i < mNumThreads; i++) {
+            threads[i]->runTouch(i);
+        }
+        for (auto t : threads) {
+            t->join();
+        }
+    }
+    for (mPass = 0; mPass < numPasses && !isOutOfTime(); mPass++) {
+        if (enqueueTiles() == 0) {
+            break;
+        }
+        if (mTimeBudgetSeconds > 0) {
+            updateMeanStandardError();
+            std::cout << "Pass " << mPass + 1 << ", "
+                      << std::max(0.0f, mTimeBudgetSeconds - getSecondsSince(startTime)) << "s left" << std::endl;
+        } else if (progressive) {
+            std::cout << "Pass " << mPass + 1 << " of at most " << numPasses << std::endl;
+        }
+
+        for (int i = 0; i < mNumThreads; i++) {
+            threads[i]->run(mImage, i);
+        }
+        for (auto t : threads) {
+            t->join();
+        }
+        std::cout << std::endl;
+    }
+    if (mStream != NULL && mStream->hasFailed()) {
+        std::cout << "Could not write a tile to " << mOutputFile << std::endl;
+        throw "Could not write a tile to the streaming output.";
+    }
+    float wallSeconds = getSecondsSince(startTime);
+    std::cout << std::endl;
+    if (progressive) {
+        int64_t converged = std::count(mConverged.begin(), mConverged.end(), (char) true);
+        int64_t totalSamples = 0;
+        for (int n : mSampleCounts) {
+            totalSamples += n;
+        }
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Passes" << mPass << std::endl;
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Converged Pixels"
+                  << 100.0 * converged / mConverged.size() << "%" << std::endl;
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Iterations/Pixel"
+                  << totalSamples / (double) mSampleCounts.size() << " (min "
+                  << *std::min_element(mSampleCounts.begin(), mSampleCounts.end()) << ", max "
+                  << *std::max_element(mSampleCounts.begin(), mSampleCounts.end()) << ")" << std::endl;
+        std::cout << std::endl;
+    }
+    std::vector<const Stats *> stats;
+    for (auto t : threads) {
+        t->mStats.print();
+        stats.push_back(&t->mStats);
+    }
+    printAggregateStats(stats, wallSeconds);
+
+    if (mDenoiser != NULL) {
+        TimePoint denoiseStart = Clock::now();
+        if (progressive) {
+            for (int y = mRegion.y0; y <= mRegion.y1; y++) {
+                for (int x = mRegion.x0; x <= mRegion.x1; x++) {
+                    float standardError = computeStandardError(mImage->index(x, y));
+                    mDenoiser->setVariance(x, y, standardError * standardError);
+                }
+            }
+        }
+        mDenoiser->run(mImage, mNumThreads);
+        finishTile(mRegion);
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Denoise (seconds)" << getSecondsSince(denoiseStart) << std::endl;
+        std::cout << std::endl;
+    }
+    if (mStream != NULL) {
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Streamed (MB)" << mStream->size() / 1e6 << std::endl;
+        return;
+    }
+
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Framebuffer (MB)" << mImage->getBytes() / 1e6 << std::endl;
+    TimePoint writeStart = Clock::now();
+    if (mNumParts > 1) {
+        PartialHeader header = { mWidth, mHeight, mRegion, mPart, mNumParts, mGamma, mEnableDither, partTiles };
+        std::string file = getPartialFile(mOutputFile, mPart);
+        size_t bytes = writePartialImage(file, header, *mImage);
+        if (bytes == 0) {
+            std::cout << "Could not write " << file << std::endl;
+            throw "Could not write the partial image.";
+        }
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Partial Image" << file << std::endl;
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Write (seconds)" << getSecondsSince(writeStart) << std::endl;
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Partial (MB)" << bytes / 1e6 << std::endl;
+        return;
+    }
+    ImageEncoder encoder(mGamma, mEnableDither);
+    size_t bytes = 0;
+    double rawBytes = 3.0 * regionWidth * regionHeight;
+    if (isCompositing) {
+        bytes = compositeImage(mOutputFile, mCompositeFile, mWidth, mHeight, *mImage, encoder, mNumThreads);
+        rawBytes = 3.0 * mWidth * mHeight;
+        if (bytes == 0) {
+            std::cout << "Could not read a " << mWidth << " x " << mHeight << " PPM from " << mCompositeFile
+                      << ", writing the crop on its own" << std::endl;
+            rawBytes = 3.0 * regionWidth * regionHeight;
+        }
+    }
+    if (bytes == 0) {
+        bytes = writeImage(mOutputFile, *mImage, encoder, mNumThreads);
+    }
+    float writeSeconds = getSecondsSince(writeStart);
+    // Rates are of the 8-bit pixels, so that they compare between codecs.
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Write (seconds)" << writeSeconds << std::endl;
+    if (writeSeconds > 0) {
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Write (MB/s)" << rawBytes / 1e6 / writeSeconds << std::endl;
+    }
+    if (getImageFormat(mOutputFile) != PPM) {
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Compression Ratio" << rawBytes / bytes << std::endl;
+    }
+    if (mAovs != NULL) {
+        mAovs->write(mOutputFile);
+    }
+}
+
+
+/// The rendered image, or NULL when it was streamed to its file.
+const Framebuffer *Renderer::getImage() const {
+    return mImage;
+}
+
+
+/**
+ * Note that the pixels of `tile` have changed, for the preview. They are
+ * copied here, by the thread that just wrote them, as a later pass or the
+ * denoiser may be writing them again by the time the preview looks.
+ */
+void Renderer::finishTile(const Tile &tile) {
+    if (!mEnablePreview || mImage == NULL) {
+        return;
+    }
+    TileSnapshot snapshot = { tile, std::vector<Vec3f>() };
+    snapshot.pixels.reserve(tile.area());
+    for (int y = tile.y0; y <= tile.y1; y++) {
+        for (int x = tile.x0; x <= tile.x1; x++) {
+            snapshot.pixels.push_back(mImage->get(x, y));
+        }
+    }
+    std::lock_guard<std::mutex> lock(mPreviewLock);
+    mFinishedTiles.push_back(std::move(snapshot));
+}
+
+
+/**
+ * The tiles finished since the last call, for the preview to show. The lock
+ * is only held to swap the list out, so render threads never wait on the
+ * preview copying pixels.
+ */
+std::vector<TileSnapshot> Renderer::takeFinishedTiles() {
+    std::vector<TileSnapshot> tiles;
+    std::lock_guard<std::mutex> lock(mPreviewLock);
+    tiles.swap(mFinishedTiles);
+    return tiles;
+}
+
+
+/**
+ * Divides the region being rendered into TILE_SIZE by TILE_SIZE tiles in
+ * scanline order. The tiles along the edges of the region may be smaller.
+ * Tiles stay on the grid of the whole image, so that a pixel of a cropped
+ * render sees the same tile edges, and renders the same, as in a full one.
+ */
+void Renderer::buildTiles() {
+    mTiles.clear();
+    for (int y = mRegion.y0 / TILE_SIZE * TILE_SIZE; y <= mRegion.y1; y += TILE_SIZE) {
+        for (int x = mRegion.x0 / TILE_SIZE * TILE_SIZE; x <= mRegion.x1; x += TILE_SIZE) {
+            mTiles.push_back(Tile{
+                std::max(mRegion.x0, x),
+                std::max(mRegion.y0, y),
+                std::min(mRegion.x1, x + TILE_SIZE - 1),
+                std::min(mRegion.y1, y + TILE_SIZE - 1),
+                0,
+                false
+            });
+        }
+    }
+}
+
+
+/**
+ * Place every tile that has yet to converge in its NUMA node's work queue and
+ * reset the progress bar. Returns the number of pixels queued.
+ */
+int64_t Renderer::enqueueTiles() {
     mQueueLock.lock();
-    for (
-        int i = WORK_BLOCK_SIZE - 1, j = 0;
-        j <= mHeight;
-        j = i + 1, i += WORK_BLOCK_SIZE
-    ) {
-        mWorkQueue.push(std::make_pair(j, std::min(mHeight - 1, i)));
+    mCompletedPixels = 0;
+    mQueuedPixels = 0;
+    for (int i = 0; i < (int) mTiles.size(); i++) {
+        if (mTiles[i].converged) {
+            continue;
+        }
+        mWorkQueues[getNumaNode(mTiles[i].y0)].push(i);
+        mQueuedPixels += mTiles[i].area();
     }
     mQueueLock.unlock();
 
+    return mQueuedPixels;
+}
+
+
+/**
+ * The image is split into one horizontal band of tile rows per NUMA node.
+ * Since the image is stored row by row, each band is a contiguous range of
+ * memory. Tiles (even split ones) never straddle a row of tiles, so every
+ * pixel of a tile falls in the band of its top row.
+ */
+int Renderer::getNumaNode(int y) {
+    int firstTileRow = mRegion.y0 / TILE_SIZE;
+    int numTileRows = mRegion.y1 / TILE_SIZE - firstTileRow + 1;
+    return (y / TILE_SIZE - firstTileRow) * (int) mNumaNodeCpus.size() / numTileRows;
+}
+
+
+/**
+ * Pins render thread `id` to a CPU, spreading consecutive threads over the
+ * NUMA nodes, and returns the node the thread was placed on. Without NUMA
+ * placement every thread stays unpinned on node 0.
+ */
+int Renderer::placeThread(int id) {
+    if (!mEnableNumaPlacement) {
+        return 0;
+    }
+
+    int numNodes = mNumaNodeCpus.size();
+    int node = id % numNodes;
+    auto &cpus = mNumaNodeCpus[node];
+    bindCurrentThreadToCpu(cpus[(id / numNodes) % cpus.size()]);
+    return node;
+}
+
+
+/**
+ * Clears this thread's share of the band of rows its NUMA node renders. This
+ * is the first touch of those pages, so the kernel places them on the node
+ * that is going to write the rest of the render into them.
+ */
+void Renderer::touchFramebuffer(int id, int node) {
+    int numNodes = mNumaNodeCpus.size();
+    int bandStart = -1;
+    int bandEnd = -1;
+    for (int y = mRegion.y0 / TILE_SIZE * TILE_SIZE; y <= mRegion.y1; y += TILE_SIZE) {
+        if (getNumaNode(y) == node) {
+            if (bandStart < 0) {
+                bandStart = std::max(mRegion.y0, y);
+            }
+            bandEnd = std::min(mRegion.y1, y + TILE_SIZE - 1);
+        }
+    }
+    if (bandStart < 0) {
+        return;
+    }
+
+    // Threads id, id + numNodes, id + 2 * numNodes, ... share the band.
+    int nodeThreads = (mNumThreads - node + numNodes - 1) / numNodes;
+    int share = id / numNodes;
+    int rows = bandEnd - bandStart + 1;
+    mImage->touchRows(
+        bandStart + rows * share / nodeThreads,
+        bandStart + rows * (share + 1) / nodeThreads - 1
+    );
+}
+
+
+/**
+ * Renders the image at 1 / PREPASS_STRIDE resolution with the render threads
+ * and records how many rays each tile needed. A tile covering a glass sphere
+ * traces many more rays per pixel than a tile covering a flat wall.
+ */
+void Renderer::estimateTileCosts(float aspectRatio, float fovRatio) {
+    std::cout << "Estimating tile costs" << std::endl;
+    enqueueTiles();
+
     std::vector<std::shared_ptr<RenderThread>> threads;
     for (int i = 0; i < mNumThreads; i++) {
-        auto t = std::make_shared<RenderThread>(this, aspectRatio, fovRatio);
+        auto t = std::shared_ptr<RenderThread>(new RenderThread(this, aspectRatio, fovRatio));
         threads.push_back(t);
 
-        t->run(mImage, i);
+        t->runPrePass(i);
     }
     for (auto t : threads) {
         t->join();
     }
-    std::cout << std::endl << std::endl;
-    for (auto t : threads) {
-        t->mStats.print();
-    }
-
-    writeImage(mOutputFile, mWidth, mHeight, mImage);
+    std::cout << std::endl;
 }
 
 
-void Renderer::gl() {
-    renderImageToGL(mWidth, mHeight, mImage);
+/**
+ * Splits tiles that are expensive enough to dominate a thread's share of the
+ * work and then orders the tiles from most to least expensive. Handing out
+ * the most expensive tiles first means the last tiles left in the queue are
+ * cheap, so the threads finish at nearly the same time instead of one thread
+ * grinding through a tile of glass while the others sit idle.
+ */
+void Renderer::balanceTiles() {
+    float totalCost = 0;
+    for (auto &tile : mTiles) {
+        totalCost += tile.cost;
+    }
+    float maxCost = totalCost / (mNumThreads * TILE_SPLIT_SHARE);
+
+    std::vector<Tile> pending(mTiles);
+    std::vector<Tile> balanced;
+    while (!pending.empty()) {
+        Tile tile = pending.back();
+        pending.pop_back();
+
+        int width = tile.x1 - tile.x0 + 1;
+        int height = tile.y1 - tile.y0 + 1;
+        if (tile.cost <= maxCost || width < 2 * MIN_TILE_SIZE || height < 2 * MIN_TILE_SIZE) {
+            balanced.push_back(tile);
+            continue;
+        }
+
+        // Quarter the tile. The pre-pass is too coarse to say where inside
+        // the tile the cost is, so it is shared out by area. The cuts stay
+        // on the MIN_TILE_SIZE grid that adaptive anti-aliasing compares
+        // neighbours within, so splitting never changes a pixel.
+        int midX = (tile.x0 + width / 2) / MIN_TILE_SIZE * MIN_TILE_SIZE;
+        int midY = (tile.y0 + height / 2) / MIN_TILE_SIZE * MIN_TILE_SIZE;
+        Tile quarters[] = {
+            { tile.x0, tile.y0, midX - 1, midY - 1, 0, false },
+            { midX, tile.y0, tile.x1, midY - 1, 0, false },
+            { tile.x0, midY, midX - 1, tile.y1, 0, false },
+            { midX, midY, tile.x1, tile.y1, 0, false }
+        };
+        for (auto &quarter : quarters) {
+            quarter.cost = tile.cost * quarter.area() / (float) tile.area();
+            pending.push_back(quarter);
+        }
+    }
+
+    std::stable_sort(balanced.begin(), balanced.end(), [](const Tile &a, const Tile &b) {
+        return a.cost > b.cost;
+    });
+    mTiles = balanced;
 }
 
 
 /**
- * Each render thread gets a batch of WORK_BLOCK_SIZE rows to render at a time.
- * This function returns true if there is work remaining in the queue after
- * it populates `start` and `end` (if the queue was non-empty).
+ * Each render thread gets a single tile to render at a time. The tile the
+ * thread just finished (if any) is passed back in `tileIndex` so that it can
+ * be counted towards the progress bar. This function returns true if there
+ * was work remaining in any queue, in which case `tileIndex` is populated with
+ * the next tile to render. Threads drain the queue of their own NUMA node
+ * before helping with the other nodes' tiles.
  */
-bool Renderer::getWork(int &start, int &end) {
+bool Renderer::getWork(int &tileIndex, int node) {
     mQueueLock.lock();
-    if (end != 0) {
-        mCompletedRows += (end + 1 - start);
+    if (tileIndex >= 0) {
+        mCompletedPixels += mTiles[tileIndex].area();
     }
-    if (mWorkQueue.empty()) {
-        printProgress();
+    if (isOutOfTime() || (mStream != NULL && mStream->hasFailed())) {
         mQueueLock.unlock();
         return false;
     }
+    for (int i = 0; i < (int) mWorkQueues.size(); i++) {
+        auto &queue = mWorkQueues[(node + i) % mWorkQueues.size()];
+        if (queue.empty()) {
+            continue;
+        }
+
+        tileIndex = queue.front();
+        queue.pop();
+        printProgress();
+        mQueueLock.unlock();
+        return true;
+    }
 
-    auto t = mWorkQueue.front();
-    mWorkQueue.pop();
     printProgress();
     mQueueLock.unlock();
+    return false;
+}
 
-    std::tie(start, end) = t;
-    return true;
+
+bool Renderer::isProgressive() {
+    return mConvergenceThreshold > 0 || mTimeBudgetSeconds > 0;
+}
+
+
+/**
+ * Whether the primary rays of a pixel differ from one iteration to the next.
+ * They do with a lens, or with anti-aliasing samples that aren't on a fixed
+ * grid. A regular grid is only fixed when it has a square number of cells.
+ */
+bool Renderer::hasStochasticPrimaryRays() {
+    if (mScene.mCamera.mApertureRadius > 0) {
+        return true;
+    }
+    if (mAntiAliasing == 0) {
+        return false;
+    }
+
+    int s = (int) sqrtf(mAntiAliasing);
+    return mSamplingMethod != REGULAR || s * s != mAntiAliasing;
+}
+
+
+/**
+ * Whether shading the same hit twice can give different colors. It can with
+ * soft shadows, or when only some of the lights are picked for each hit.
+ */
+bool Renderer::hasStochasticShading() {
+    return mEnableSoftShadows || (mLightSamples > 0 && mLightSamples < (int) mScene.mPointLights.size());
+}
+
+
+/**
+ * The number of iterations each pixel really needs: every iteration would
+ * come out exactly the same when nothing is stochastic, so one will do.
+ */
+int Renderer::getIterations() {
+    if (!hasStochasticPrimaryRays() && !hasStochasticShading()) {
+        return 1;
+    }
+    return mNoiseReduction;
+}
+
+
+/**
+ * Primary hits are worth caching when every iteration of a pixel traces the
+ * same primary rays and there is more than one iteration. The cache only
+ * lives as long as a pixel does, so it is not used by progressive renders,
+ * which render a pixel's iterations in separate passes.
+ */
+bool Renderer::shouldCachePrimaryHits() {
+    return mEnablePrimaryHitCache && !isProgressive() && !hasStochasticPrimaryRays() && getIterations() > 1;
+}
+
+
+/**
+ * The first pass always runs to completion, however small the budget, so that
+ * every pixel has at least one sample before the render may stop.
+ */
+bool Renderer::isOutOfTime() {
+    return mTimeBudgetSeconds > 0 && mPass > 0 && Clock::now() >= mDeadline;
+}
+
+
+bool Renderer::isConverged(int x, int y) {
+    return mConverged[mImage->index(x, y)];
+}
+
+
+int Renderer::getSampleCount(int x, int y) {
+    return mSampleCounts[mImage->index(x, y)];
+}
+
+
+/// The standard error of the mean luminance of pixel `i`.
+float Renderer::computeStandardError(size_t i) {
+    int n = mSampleCounts[i];
+    if (n < 2) {
+        return 0;
+    }
+    return sqrtf(mSumSquares[i] / (n - 1) / n);
+}
+
+
+void Renderer::updateMeanStandardError() {
+    double sum = 0;
+    int64_t count = 0;
+    for (size_t i = 0; i < mSampleCounts.size(); i++) {
+        if (!mConverged[i]) {
+            sum += computeStandardError(i);
+            count++;
+        }
+    }
+    mMeanStandardError = count > 0 ? sum / count : 0;
+}
+
+
+/**
+ * Every unconverged pixel gets one sample per pass, except in a time
+ * budgeted render. There, once every pixel has a few samples to estimate its
+ * variance from, each pass hands out samples in proportion to how noisy each
+ * pixel still is compared to the rest of the image. Quiet pixels may get
+ * none at all in a pass so the time goes where it is most needed.
+ */
+int Renderer::getSamplesThisPass(int x, int y) {
+    size_t i = mImage->index(x, y);
+    if (mTimeBudgetSeconds <= 0 || mSampleCounts[i] < MIN_CONVERGENCE_SAMPLES || mMeanStandardError <= 0) {
+        return 1;
+    }
+
+    float share = computeStandardError(i) / mMeanStandardError;
+    return std::min(MAX_SAMPLES_PER_PASS, (int) (share + 0.5f));
+}
+
+
+/**
+ * Folds one more sample into the running mean color and the running variance
+ * of the luminance of a pixel using Welford's algorithm [15]. Returns true
+ * once the pixel has converged, which is when the 95% confidence interval of
+ * its mean luminance is narrower than mConvergenceThreshold or, without a time
+ * budget, it has been sampled once per iteration. When nothing is stochastic
+ * one sample is all there is to take, budget or not.
+ */
+bool Renderer::accumulateSample(int x, int y, Vec3f color) {
+    size_t i = mImage->index(x, y);
+    int n = ++mSampleCounts[i];
+    Vec3f mean = n == 1 ? Vec3f({ 0, 0, 0 }) : mImage->get(x, y);
+    float previousLuminance = luminance(mean);
+    mean = add(mean, divide(subtract(color, mean), (float) n));
+    mImage->set(x, y, mean);
+    mSumSquares[i] += (luminance(color) - previousLuminance) * (luminance(color) - luminance(mean));
+
+    int iterations = getIterations();
+    if ((mTimeBudgetSeconds <= 0 || iterations == 1) && n >= iterations) {
+        mConverged[i] = true;
+    } else if (mConvergenceThreshold > 0 && n >= MIN_CONVERGENCE_SAMPLES) {
+        float variance = mSumSquares[i] / (n - 1);
+        mConverged[i] = 1.96f * sqrtf(variance / n) < mConvergenceThreshold;
+    }
+
+    return mConverged[i];
 }
 
 
 /// Just a simple progress bar using a carriage return to write over itself.
 void Renderer::printProgress() {
-    float progress = (mCompletedRows / (float) mHeight) * 100;
+    float progress = (mCompletedPixels / (float) mQueuedPixels) * 100;
     std::cout << std::right
              << std::fixed << std::setw(5) << std::setprecision(1) << std::setfill(' ')
              << progress << "% [";
@@ -137,7 +788,32 @@ RenderThread::RenderThread(Renderer *renderer, float aspectRatio, float fovRatio
 , mAspectRatio(aspectRatio)
 , mFovRatio(fovRatio)
 , mThread(NULL)
-{}
+, mSampler(createSampler(renderer->mSamplingMethod, (int) sqrtf(renderer->mAntiAliasing)))
+, mNode(0)
+, mImage(NULL)
+, mTile(NULL)
+, mSawTransmission(false)
+, mSampleTaken()
+, mPrimarySamples()
+, mCircleOfConfusion(0)
+, mConeSpread(0)
+{
+    // Each sample's ray covers its share of the pixel, which subtends about
+    // 2 mFovRatio / mHeight radians.
+    if (mRenderer->mEnableTextureFiltering) {
+        mConeSpread = 2 * mFovRatio / mRenderer->mHeight / sqrtf(std::max(1, mRenderer->mAntiAliasing));
+    }
+}
+
+
+void *RenderThread::operator new(size_t size) {
+    return allocateAligned(size, CACHE_LINE_SIZE);
+}
+
+
+void RenderThread::operator delete(void *pointer) {
+    freeAligned(pointer);
+}
 
 
 void RenderThread::join() {
@@ -163,7 +839,7 @@ void RenderThread::join() {
  * \param x Pixel space coordinate on the rendering plane.
  * \param y Pixel space coordinate on the rendering plane.
  */
-void RenderThread::computePrimaryRay(int x, int y, float xS, float yS, Vec3f &direction, Vec3f &origin) {
+void RenderThread::computePrimaryRay(int x, int y, float xS, float yS, float lensU, float lensV, Vec3f &direction, Vec3f &origin) {
     // Loosely based on [1].
     //
     // Normalize the raster space (mWidth by mHeight pixels) into
@@ -175,33 +851,144 @@ void RenderThread::computePrimaryRay(int x, int y, float xS, float yS, Vec3f &di
     float pixelX = (2 * deviceCoordX - 1) * mFovRatio * mAspectRatio;
     float pixelY = (1 - 2 * deviceCoordY) * mFovRatio;
 
-    mRenderer->mScene.mCamera.computePrimaryRay(pixelX, pixelY, direction, origin);
+    mRenderer->mScene.mCamera.computePrimaryRay(
+        pixelX,
+        pixelY,
+        lensU,
+        lensV,
+        direction,
+        origin
+    );
+}
+
+
+/**
+ * Finds the footprint of a primary sample on the surface it hit from ray
+ * differentials: the rays through the neighbouring samples, one sample
+ * spacing over and one down, meet the plane tangent to the hit at two
+ * corners of the footprint. This follows whatever projection the camera
+ * uses. The cone of any secondary ray starts as wide as the footprint.
+ */
+void RenderThread::computePrimaryFootprint(int x, int y, float xS, float yS, float lensU, float lensV, Hit &hit) {
+    float spacing = 1 / sqrtf(std::max(1, mRenderer->mAntiAliasing));
+    Vec3f sides[2];
+    for (int i = 0; i < 2; i++) {
+        Vec3f direction, origin;
+        computePrimaryRay(x, y, xS + (i == 0 ? spacing : 0), yS + (i == 1 ? spacing : 0), lensU, lensV, direction, origin);
+        float facing = dot(direction, hit.normal);
+        if (fabs(facing) < 1e-4) {
+            return;
+        }
+        float t = dot(subtract(hit.position, origin), hit.normal) / facing;
+        sides[i] = subtract(add(origin, multiply(direction, t)), hit.position);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        hit.footprint[i] = fabs(sides[0][i]) + fabs(sides[1][i]);
+    }
+    hit.coneWidth = sqrtf(fmax(dot(sides[0], sides[0]), dot(sides[1], sides[1])));
 }
 
 
 /**
  * std::thread can't accept an instance method so we need this wrapper.
  */
-void threadBody(RenderThread *t, Vec3f *image, const int id) {
+void threadBody(RenderThread *t, Framebuffer *image, const int id) {
     t->render(image, id);
 }
 
 
-void RenderThread::run(Vec3f *image, const int id) {
+void prePassThreadBody(RenderThread *t, const int id) {
+    t->estimateCosts(id);
+}
+
+
+void touchThreadBody(RenderThread *t, const int id) {
+    t->touchFramebuffer(id);
+}
+
+
+void RenderThread::run(Framebuffer *image, const int id) {
     mThread = std::make_shared<std::thread>(threadBody, this, image, id);
 }
 
 
+void RenderThread::runPrePass(const int id) {
+    mThread = std::make_shared<std::thread>(prePassThreadBody, this, id);
+}
+
+
+void RenderThread::runTouch(const int id) {
+    mThread = std::make_shared<std::thread>(touchThreadBody, this, id);
+}
+
+
+/**
+ * The contrast between two colors as defined by [14]: the largest
+ * difference of a channel relative to its magnitude.
+ */
+float computeContrast(Vec3f a, Vec3f b) {
+    float contrast = 0;
+    for (int i = 0; i < 3; i++) {
+        float sum = a[i] + b[i];
+        if (sum > 1e-4) {
+            contrast = fmax(contrast, fabs(a[i] - b[i]) / sum);
+        }
+    }
+    return contrast;
+}
+
+
 /**
  * Render a single pixel multiple times and return the average colour.
  */
 Vec3f RenderThread::computePixelAverage(int x, int y) {
+    if (mRenderer->mCachePrimaryHits) {
+        mPrimarySamples.assign(std::max(1, mRenderer->mAntiAliasing), PrimarySample());
+    }
+
+    int iterations = mRenderer->getIterations();
+    mCircleOfConfusion = 0;
     Vec3f color({ 0, 0, 0 });
-    for (int i = 0; i < mRenderer->mNoiseReduction; i++) {
-        color = add(color, renderPixel(x, y));
+    Vec3f first({ 0, 0, 0 });
+    float meanLuminance = 0;
+    float sumSquares = 0;
+    for (int i = 0; i < iterations; i++) {
+        Vec3f iteration = renderPixel(x, y, i);
+        color = add(color, iteration);
+        float delta = luminance(iteration) - meanLuminance;
+        meanLuminance += delta / (i + 1);
+        sumSquares += delta * (luminance(iteration) - meanLuminance);
+        if (i == 0) {
+            first = iteration;
+        }
+        // Iterations that disagree mean something other than the lens, like
+        // a soft shadow or a texture finer than the pixel, still needs them.
+        if (mRenderer->mEnableAdaptiveDepthOfField
+                && i + 1 == MIN_DEPTH_OF_FIELD_ITERATIONS
+                && computeContrast(first, iteration) <= mRenderer->mContrastThreshold) {
+            iterations = std::min(iterations, computeDepthOfFieldIterations());
+        }
+    }
+    if (mRenderer->mDenoiser != NULL && iterations > 1) {
+        mRenderer->mDenoiser->setVariance(x, y, sumSquares / (iterations - 1) / iterations);
     }
 
-    return divide(color, (float) mRenderer->mNoiseReduction);
+    return divide(color, (float) iterations);
+}
+
+
+/**
+ * The number of iterations a pixel needs for its lens samples to converge,
+ * from the largest circle of confusion of its primary hits so far. The lens
+ * samples have to cover the circle a pixel is blurred over, so the number of
+ * iterations grows with its area. An in-focus pixel barely changes from one
+ * lens sample to the next and is done after the first few iterations.
+ */
+int RenderThread::computeDepthOfFieldIterations() {
+    float blur = fmin(1, mCircleOfConfusion / FULL_DEPTH_OF_FIELD_BLUR);
+    int iterations = (int) ceilf(mRenderer->getIterations() * blur * blur);
+    return std::max(MIN_DEPTH_OF_FIELD_ITERATIONS, iterations);
 }
 
 
@@ -211,36 +998,153 @@ Vec3f RenderThread::computePixelAverage(int x, int y) {
  * interlaced portions of the image to each thread in advance, instead of a
  * having a shared queue. This often led to one thread lagging behind the
  * others and thus wasting potential concurrency.
+ *
+ * A progressive render calls this once per pass, and each pass takes a single
+ * sample of every pixel that has not yet converged.
  */
-void RenderThread::render(Vec3f *image, const int id) {
+void RenderThread::render(Framebuffer *image, const int id) {
     // Track the total time this thread spent rendering.
     TimePoint startTime = Clock::now();
-    mStats.pixels = 0;
+    int pass = mRenderer->mPass;
+    bool progressive = mRenderer->isProgressive();
     mStats.id = id;
+    mNode = mRenderer->placeThread(id);
+    mImage = image;
+
+    int tileIndex = -1;
+    while (mRenderer->getWork(tileIndex, mNode)) {
+        Tile &tile = mRenderer->mTiles[tileIndex];
+        mTile = &tile;
+        if (pass == 0) {
+            mStats.pixels += tile.area();
+        }
+        bool countRays = mRenderer->mAovs != NULL && mRenderer->mAovs->isEnabled(AOV_RAYS);
+        int64_t before[NUM_QUANTITIES];
+        if (!progressive) {
+            // A streamed tile is rendered into scratch space of its own and
+            // written out as soon as it is done.
+            std::unique_ptr<Framebuffer> scratch;
+            if (mRenderer->mStream != NULL) {
+                scratch.reset(new Framebuffer(tile.x0, tile.y0, tile.x1 - tile.x0 + 1, tile.y1 - tile.y0 + 1, false, FLOAT_RGB));
+                mImage = scratch.get();
+            }
+            for (int y = tile.y0; y <= tile.y1; y++) {
+                for (int x = tile.x0; x <= tile.x1; x++) {
+                    if (countRays) {
+                        std::copy(mStats.quantities, mStats.quantities + NUM_QUANTITIES, before);
+                    }
+                    mImage->set(x, y, computePixelAverage(x, y));
+                    if (countRays) {
+                        addRayCounts(x, y, before);
+                    }
+                }
+            }
+            if (scratch) {
+                mRenderer->mStream->commitTile(*scratch);
+            } else {
+                mRenderer->finishTile(tile);
+            }
+            continue;
+        }
+
+        tile.converged = true;
+        for (int y = tile.y0; y <= tile.y1 && !mRenderer->isOutOfTime(); y++) {
+            for (int x = tile.x0; x <= tile.x1; x++) {
+                if (mRenderer->isConverged(x, y)) {
+                    continue;
+                }
+                if (countRays) {
+                    std::copy(mStats.quantities, mStats.quantities + NUM_QUANTITIES, before);
+                }
+                int samples = mRenderer->getSamplesThisPass(x, y);
+                bool converged = false;
+                for (int i = 0; i < samples && !converged; i++) {
+                    // Number the iterations by samples taken so far so that
+                    // the sampler sequence carries on from the last pass.
+                    Vec3f color = renderPixel(x, y, mRenderer->getSampleCount(x, y));
+                    converged = mRenderer->accumulateSample(x, y, color);
+                }
+                if (countRays) {
+                    addRayCounts(x, y, before);
+                }
+                if (!converged) {
+                    tile.converged = false;
+                }
+            }
+        }
+        mRenderer->finishTile(tile);
+    }
+
+    mStats.timeSeconds += getSecondsSince(startTime);
+}
+
 
-    int start = 0;
-    int end = 0;
-    while (mRenderer->getWork(start, end)) {
-        for (int y = start; y <= end; y++) {
-            for (int x = 0; x < mRenderer->mWidth; x++) {
-                mStats.pixels++;
-                image[y * mRenderer->mWidth + x] = computePixelAverage(x, y);
+/// Place this thread on its NUMA node and touch its share of the node's rows.
+void RenderThread::touchFramebuffer(const int id) {
+    mNode = mRenderer->placeThread(id);
+    mRenderer->touchFramebuffer(id, mNode);
+}
+
+
+/**
+ * The cost pre-pass counterpart to `render`. Traces a single primary ray
+ * through the centre of every PREPASS_STRIDE by PREPASS_STRIDE block of pixels
+ * in each tile and stores the number of rays this took, scaled up to the area
+ * of the tile, as the cost of the tile.
+ */
+void RenderThread::estimateCosts(const int id) {
+    TimePoint startTime = Clock::now();
+    mStats.id = id;
+    mNode = mRenderer->placeThread(id);
+
+    int tileIndex = -1;
+    while (mRenderer->getWork(tileIndex, mNode)) {
+        Tile &tile = mRenderer->mTiles[tileIndex];
+        int64_t startRays = countRays();
+        int samples = 0;
+        // Small tiles along the edges of the image still get one sample.
+        int offsetX = std::min(PREPASS_STRIDE / 2, (tile.x1 - tile.x0) / 2);
+        int offsetY = std::min(PREPASS_STRIDE / 2, (tile.y1 - tile.y0) / 2);
+        for (int y = tile.y0 + offsetY; y <= tile.y1; y += PREPASS_STRIDE) {
+            for (int x = tile.x0 + offsetX; x <= tile.x1; x += PREPASS_STRIDE) {
+                Vec3f direction, origin;
+                mSampler->startSample((uint64_t) y * mRenderer->mWidth + x, 0);
+                float lensU = mSampler->get(LENS_DIMENSION);
+                float lensV = mSampler->get(LENS_DIMENSION + 1);
+                computePrimaryRay(x, y, 0.5f, 0.5f, lensU, lensV, direction, origin);
+                mStats.quantities[PRIMARY]++;
+                trace(origin, direction, 0, 0);
+                samples++;
             }
         }
+
+        tile.cost = (countRays() - startRays) * tile.area() / (float) samples;
     }
 
     mStats.timeSeconds = getSecondsSince(startTime);
 }
 
 
-void RenderThread::computeAntiAliasingSample(int samples, int x, int y, float &xS, float &yS) {
-    if (mRenderer->mAntiAliasingMethod == REGULAR) {
-        xS = x * (1.0f / samples) - 0.5f;
-        yS = y * (1.0f / samples) - 0.5f;
-    } else if (mRenderer->mAntiAliasingMethod == RANDOM) {
-        xS = (rand() % 1000) / 1000.0f - 0.5f;
-        yS = (rand() % 1000) / 1000.0f - 0.5f;
-    }
+/// Add the rays traced since `before` was taken to the pixel's ray counts.
+void RenderThread::addRayCounts(int x, int y, const int64_t *before) {
+    mRenderer->mAovs->addRays(
+        x,
+        y,
+        mStats.quantities[PRIMARY] - before[PRIMARY],
+        mStats.quantities[SHADOW] - before[SHADOW],
+        mStats.quantities[SPECULAR] - before[SPECULAR] + mStats.quantities[TRANSMISSION] - before[TRANSMISSION]
+    );
+}
+
+
+/// The total number of rays of every kind this thread has traced so far.
+int64_t RenderThread::countRays() {
+    return (
+        mStats.quantities[PRIMARY] +
+        mStats.quantities[SHADOW] +
+        mStats.quantities[SPECULAR] +
+        mStats.quantities[TRANSMISSION]
+    );
 }
 
 
@@ -248,29 +1152,174 @@ void RenderThread::computeAntiAliasingSample(int samples, int x, int y, float &x
  * Takes care of anti-aliasing and calls `trace` to start the actual ray
  * tracing (finally!).
  */
-Vec3f RenderThread::renderPixel(int x, int y) {
-    Vec3f direction, origin;
+Vec3f RenderThread::renderPixel(int x, int y, int iteration) {
     if (mRenderer->mAntiAliasing == 0) {
-        computePrimaryRay(x, y, 0.5f, 0.5f, direction, origin);
-        mStats.quantities[PRIMARY]++;
-        return trace(origin, direction, 0);
+        return renderSample(x, y, iteration);
+    }
+
+    int samples = mRenderer->mAntiAliasing;
+    if (mRenderer->mEnableAdaptiveAntiAliasing && samples > ADAPTIVE_INITIAL_SAMPLES) {
+        return renderAdaptivePixel(x, y, iteration);
+    }
+
+    Vec3f color({ 0, 0, 0 });
+    for (int i = 0; i < samples; i++) {
+        color = add(color, renderSample(x, y, iteration * samples + i));
+    }
+
+    return divide(color, (float) samples);
+}
+
+
+/**
+ * Traces a single sample of a pixel. The samples of every iteration are
+ * numbered one after the other so that each iteration continues the
+ * sampler's sequence instead of repeating it. Without anti-aliasing there is
+ * one sample through the centre of the pixel per iteration.
+ *
+ * When primary hits are cached, the first iteration intersects the scene and
+ * remembers what each primary ray hit. Later iterations only shade those
+ * hits again, which is all that changes between them.
+ */
+Vec3f RenderThread::renderSample(int x, int y, uint32_t index) {
+    mStats.samples++;
+    mSampler->startSample((uint64_t) y * mRenderer->mWidth + x, index);
+
+    int samples = mRenderer->mAntiAliasing;
+    PrimarySample *cached = NULL;
+    if (mRenderer->mCachePrimaryHits) {
+        cached = &mPrimarySamples[samples == 0 ? 0 : index % samples];
+        if (cached->isCached) {
+            // Draw the primary ray's sample values anyway, so that shading
+            // gets the same values it would have without the cache.
+            if (samples > 0) {
+                mSampler->get(PIXEL_DIMENSION);
+                mSampler->get(PIXEL_DIMENSION + 1);
+            }
+            mSampler->get(LENS_DIMENSION);
+            mSampler->get(LENS_DIMENSION + 1);
+            if (!cached->doesIntersect) {
+                return Vec3f({ 0, 0, 0 });
+            }
+            return shade(cached->hit, cached->direction, 0);
+        }
+    }
+
+    float xS = 0.5f;
+    float yS = 0.5f;
+    if (samples > 0) {
+        xS = mSampler->get(PIXEL_DIMENSION) - 0.5f;
+        yS = mSampler->get(PIXEL_DIMENSION + 1) - 0.5f;
+    }
+    float lensU = mSampler->get(LENS_DIMENSION);
+    float lensV = mSampler->get(LENS_DIMENSION + 1);
+    Vec3f direction, origin;
+    computePrimaryRay(x, y, xS, yS, lensU, lensV, direction, origin);
+    mStats.quantities[PRIMARY]++;
+
+    Hit hit;
+    bool doesIntersect = intersect(origin, direction, 0, hit);
+    if (doesIntersect && mRenderer->mEnableTextureFiltering) {
+        computePrimaryFootprint(x, y, xS, yS, lensU, lensV, hit);
     }
+    if (mRenderer->mEnableAdaptiveDepthOfField) {
+        float pixelSize = 2 * mFovRatio / mRenderer->mHeight;
+        float blur = mRenderer->mScene.mCamera.circleOfConfusion(doesIntersect ? &hit.position : NULL, pixelSize);
+        mCircleOfConfusion = fmax(mCircleOfConfusion, blur);
+    }
+    if (mRenderer->mDenoiser != NULL) {
+        if (doesIntersect) {
+            Vec3f albedo = hit.object->getColor(REST(hit.position), hit.footprint);
+            mRenderer->mDenoiser->addSample(x, y, hit.normal, albedo, hit.distance);
+        } else {
+            mRenderer->mDenoiser->addSample(x, y, Vec3f({ 0, 0, 0 }), Vec3f({ 0, 0, 0 }), 0);
+        }
+    }
+    if (mRenderer->mAovs != NULL) {
+        Aovs *aovs = mRenderer->mAovs;
+        if (!doesIntersect) {
+            aovs->addSample(x, y, NULL, 0, Vec3f({ 0, 0, 0 }), Vec3f({ 0, 0, 0 }));
+        } else if (aovs->isEnabled(AOV_ALBEDO)) {
+            Vec3f albedo = hit.object->getColor(REST(hit.position), hit.footprint);
+            aovs->addSample(x, y, hit.object, hit.distance, hit.normal, albedo);
+        } else {
+            aovs->addSample(x, y, hit.object, hit.distance, hit.normal, Vec3f({ 0, 0, 0 }));
+        }
+    }
+    if (cached != NULL) {
+        cached->isCached = true;
+        cached->doesIntersect = doesIntersect;
+        cached->direction = direction;
+        cached->hit = hit;
+    }
+    if (!doesIntersect) {
+        return Vec3f({ 0, 0, 0 });
+    }
+
+    return shade(hit, direction, 0);
+}
+
+
+/**
+ * Traces a few samples spread over the pixel first and only traces the rest
+ * when the pixel looks like it needs them. That is when the first samples
+ * contrast with each other (an edge or texture boundary within the pixel),
+ * when their average contrasts with the finished neighbours to the left and
+ * above, or when one of them passed through a transparent object. Flat
+ * regions get away with the first few samples.
+ *
+ * Only neighbours within the same cell of the MIN_TILE_SIZE grid, and within
+ * the current tile, are compared against. Tiles are made of whole cells
+ * however they are split, so the result depends neither on the order threads
+ * pick up tiles in nor on how many threads or parts split the image.
+ */
+Vec3f RenderThread::renderAdaptivePixel(int x, int y, int iteration) {
+    int samples = mRenderer->mAntiAliasing;
+    int gridSize = (int) sqrtf(samples);
+    mSampleTaken.assign(samples, false);
+    mSawTransmission = false;
 
-    int s = (int) sqrtf(mRenderer->mAntiAliasing);
     Vec3f color({ 0, 0, 0 });
-    for (int ySampling = 0; ySampling < s; ySampling++) {
-        for (int xSampling = 0; xSampling < s; xSampling++) {
-            float xS = 0;
-            float yS = 0;
-            computeAntiAliasingSample(s, xSampling, ySampling, xS, yS);
-            computePrimaryRay(x, y, xS, yS, direction, origin);
+    Vec3f minColor({ INFINITY, INFINITY, INFINITY });
+    Vec3f maxColor({ 0, 0, 0 });
+    for (int i = 0; i < ADAPTIVE_INITIAL_SAMPLES; i++) {
+        int index = i;
+        if (mRenderer->mSamplingMethod == REGULAR) {
+            // The first few cells of a regular grid are all in its top row,
+            // so pick cells from each quarter of the grid instead.
+            int cellX = (2 * (i % 2) + 1) * gridSize / 4;
+            int cellY = (2 * (i / 2) + 1) * gridSize / 4;
+            index = cellY * gridSize + cellX;
+        }
+        mSampleTaken[index] = true;
 
-            color = add(color, trace(origin, direction, 0));
-            mStats.quantities[PRIMARY]++;
+        Vec3f sample = renderSample(x, y, iteration * samples + index);
+        color = add(color, sample);
+        for (int c = 0; c < 3; c++) {
+            minColor[c] = fmin(minColor[c], sample[c]);
+            maxColor[c] = fmax(maxColor[c], sample[c]);
         }
     }
 
-    return divide(color, (float) mRenderer->mAntiAliasing);
+    Vec3f mean = divide(color, (float) ADAPTIVE_INITIAL_SAMPLES);
+    float contrast = computeContrast(minColor, maxColor);
+    if (x > mTile->x0 && x % MIN_TILE_SIZE != 0) {
+        contrast = fmax(contrast, computeContrast(mean, mImage->get(x - 1, y)));
+    }
+    if (y > mTile->y0 && y % MIN_TILE_SIZE != 0) {
+        contrast = fmax(contrast, computeContrast(mean, mImage->get(x, y - 1)));
+    }
+    if (!mSawTransmission && contrast < mRenderer->mContrastThreshold) {
+        return mean;
+    }
+
+    for (int index = 0; index < samples; index++) {
+        if (!mSampleTaken[index]) {
+            color = add(color, renderSample(x, y, iteration * samples + index));
+        }
+    }
+
+    return divide(color, (float) samples);
 }
 
 
@@ -281,18 +1330,59 @@ Vec3f RenderThread::renderPixel(int x, int y) {
  * `mMaxDepth`.
  *
  * If the ray does not intersect with any object then the background color is
- * returned.
+ * returned. Otherwise the intersection is shaded by `shade`.
  *
- * Otherwise, the color of a pixel is determined by the material properties of
- * the object this ray intersects. This is the sum of the following components,
- * each scaled by a coefficient defined by the material.
- *
- *   - Ambient, independent of lighting and recursive calls
- *   - Diffuse, dependent on lighting
- *   - Specular, dependent on a recursive `trace` call for reflections
- *   - Transmission, dependent on a recursive `trace` call for refraction
+ * @param coneWidth The width of the ray's cone at `origin`, for filtering
+ *        textures.
+ */
+Vec3f RenderThread::trace(Vec3f origin, Vec3f ray, int depth, float coneWidth) {
+    Hit hit;
+    if (!intersect(origin, ray, coneWidth, hit)) {
+        return Vec3f({ 0, 0, 0 });
+    }
+
+    return shade(hit, ray, depth);
+}
+
+
+/**
+ * The extent along each axis of the footprint a ray's cone leaves on a
+ * surface, which is the cone's cross-section projected onto the surface
+ * along the ray. Two sides of the cross-section land on the surface as two
+ * sides of a parallelogram, and the box around it bounds the footprint. The
+ * footprint stretches as the ray grazes the surface, up to a limit.
+ */
+Vec3f computeFootprint(Vec3f ray, Vec3f normal, float width) {
+    Vec3f footprint({ 0, 0, 0 });
+    if (width <= 0) {
+        return footprint;
+    }
+
+    // Line the cross-section up with the rows of pixels where possible, since
+    // a pixel's footprint is square in the image.
+    Vec3f a = fabs(ray[0]) > 0.9f ? Vec3f({ 0, 1, 0 }) : Vec3f({ 1, 0, 0 });
+    Vec3f e1 = normalize(subtract(a, multiply(ray, dot(a, ray))));
+    Vec3f e2 = crossProduct(ray, e1);
+    float facing = dot(ray, normal);
+    if (fabs(facing) < 0.05f) {
+        facing = facing < 0 ? -0.05f : 0.05f;
+    }
+
+    Vec3f d1 = subtract(e1, multiply(ray, dot(e1, normal) / facing));
+    Vec3f d2 = subtract(e2, multiply(ray, dot(e2, normal) / facing));
+    for (int i = 0; i < 3; i++) {
+        footprint[i] = width * (fabs(d1[i]) + fabs(d2[i]));
+    }
+    return footprint;
+}
+
+
+/**
+ * Finds the closest object along a ray and fills in `hit` with everything
+ * shading needs to know about the intersection. Returns false if the ray
+ * escapes the scene.
  */
-Vec3f RenderThread::trace(Vec3f origin, Vec3f ray, int depth) {
+bool RenderThread::intersect(Vec3f origin, Vec3f ray, float coneWidth, Hit &hit) {
     std::shared_ptr<SceneObject> intersectionObject = NULL;
     float intersectionScalar;
     bool doesIntersect = mRenderer->mScene.getIntersection(
@@ -303,7 +1393,7 @@ Vec3f RenderThread::trace(Vec3f origin, Vec3f ray, int depth) {
     );
 
     if (!doesIntersect) {
-        return Vec3f({ 0, 0, 0 });
+        return false;
     }
     mStats.quantities[INTERSECTIONS]++;
 
@@ -311,70 +1401,293 @@ Vec3f RenderThread::trace(Vec3f origin, Vec3f ray, int depth) {
     // the intersection occurs at, since they just solve the parametric
     // equation of the ray. We must compute the actual point of intersection
     // and the normal of the object at that point.
-    Vec3f intersection = add(origin, multiply(ray, intersectionScalar));
-    Vec3f normal = intersectionObject->getNormalDir(intersection);
+    hit.object = intersectionObject.get();
+    hit.distance = intersectionScalar;
+    hit.position = add(origin, multiply(ray, intersectionScalar));
+    hit.normal = intersectionObject->getNormalDir(hit.position);
+    hit.coneWidth = coneWidth + mConeSpread * intersectionScalar;
+    hit.footprint = computeFootprint(ray, hit.normal, hit.coneWidth);
+    return true;
+}
+
+
+/**
+ * Traces a shadow ray from `origin` towards a light `distance` away and
+ * returns the fraction of the light's intensity that reaches `origin`.
+ * Intersecting with an object that isn't 100% transparent or 100% opaque
+ * means that a fraction of the intensity gets through. The intensity starts at
+ * 1 and each time an object is intersected along the ray's path to the light
+ * source, the intensity drops based on the intersection's transparency.
+ */
+float RenderThread::traceShadowRay(SceneObject *ignore, Vec3f origin, Vec3f ray, float distance) {
+    mStats.quantities[SHADOW]++;
+
+    float k;
+    float intensity = 1;
+    for (auto testObj : mRenderer->mScene.mObjects) {
+        if (testObj.get() == ignore) {
+            continue;
+        }
+        // We need to check for just a smidge of bias to ensure we're not
+        // intersecting with testObj. We also need to ensure that the distance
+        // to the object is less than the distance to the light, since the
+        // light could be between the two objects (especially with planes
+        // where there is usually an intersection with the ray).
+        if (testObj->intersect(origin, ray, k) && k >= 1e-4 && k < distance) {
+            intensity -= 1 - fmax(0, testObj->mMaterial->transmission);
+            // We can stop testing objects once the intensity drops below 0,
+            // since it can never increase.
+            if (intensity <= 1e-4) {
+                break;
+            }
+        }
+    }
+
+    return intensity;
+}
+
+
+/**
+ * Traces a few probe shadow rays from a hit to points spread around the
+ * outline of a light, where an occluder starts to hide it. Most points are
+ * fully lit or fully in shadow, which the probes all agree on, and then no
+ * other shadow rays are needed. Returns false if the probes disagree because
+ * the point is in a penumbra.
+ *
+ * @param offset Rotates the probes around the outline, in [0, 1).
+ * @param intensity Set to the intensity every probe agreed on.
+ */
+bool RenderThread::probeShadows(const Hit &hit, PointLight *light, float offset, float &intensity) {
+    int probes = mRenderer->mShadowProbes;
+    for (int s = 0; s < probes; s++) {
+        float distance;
+        Vec3f shadowRay = light->silhouetteDirection(hit.position, distance, (s + offset) / probes);
+        float probe = traceShadowRay(hit.object, hit.position, shadowRay, distance);
+        if (s == 0) {
+            intensity = probe;
+        } else if (fabs(probe - intensity) > 1e-4) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/// The three sample dimensions from `dimension` on that place a light sample.
+Vec3f RenderThread::getLightSample(int dimension) {
+    if (!mRenderer->mEnableSoftShadows) {
+        return Vec3f({ 0.5f, 0.5f, 0.5f });
+    }
+
+    return Vec3f({
+        mSampler->get(dimension),
+        mSampler->get(dimension + 1),
+        mSampler->get(dimension + 2)
+    });
+}
+
+
+/**
+ * The diffuse color a light contributes to a hit. A shadow ray is computed by
+ * the point light and used to see if the light is visible from the object.
+ * There may be an object in between the intersection point and the light, in
+ * which case the point is in shadow and the light contributes nothing.
+ *
+ * @param sample Places the light's shadow samples when soft shadows are on.
+ */
+Vec3f RenderThread::shadeLight(const Hit &hit, PointLight *light, Vec3f sample, Vec3f materialColor) {
+    // Lights that are too far away or behind the surface need no shadow rays.
+    if (!light->reaches(hit.position, hit.normal, mRenderer->mEnableSoftShadows)) {
+        return Vec3f({ 0, 0, 0 });
+    }
+
+    int shadowSamples = 1;
+    if (mRenderer->mEnableSoftShadows) {
+        shadowSamples = std::max(1, light->mShadowSamples);
+    }
+    float diffuse = hit.object->mMaterial->diffuse;
+
+    // Several shadow rays spread over the light's volume smooth out a
+    // penumbra without tracing the rest of the image again. They are all
+    // placed from this sample's dimensions.
+    Vec3f lightColor({ 0, 0, 0 });
+    // When adaptive, the probes decide whether the shadow rays are needed. A
+    // point the probes agree is lit still places every sample, since the
+    // facing ratio varies over the light.
+    bool isAgreed = false;
+    float agreedIntensity = 0;
+    int probes = mRenderer->mShadowProbes;
+    if (mRenderer->mEnableAdaptiveShadows && probes > 0 && probes < shadowSamples) {
+        mStats.shadowTests++;
+        isAgreed = probeShadows(hit, light, sample[0], agreedIntensity);
+        if (!isAgreed) {
+            mStats.penumbraTests++;
+        } else if (agreedIntensity <= 0) {
+            return lightColor;
+        }
+    }
+    for (int s = 0; s < shadowSamples; s++) {
+        float distance;
+        Vec3f shadowRay = light->direction(
+            hit.position,
+            distance,
+            mRenderer->mEnableSoftShadows,
+            stratifiedPoint(sample, s, shadowSamples)
+        );
+        float facing = dot(shadowRay, hit.normal);
+        if (facing <= 0) {
+            continue;
+        }
+        float intensity = agreedIntensity;
+        if (!isAgreed) {
+            intensity = traceShadowRay(hit.object, hit.position, shadowRay, distance);
+        }
+
+        // Use the facing ratio, the shadow intensity computed, the diffuse
+        // coefficient of the material, and the facing ratio of the shadow ray
+        // and normal to compute the final diffuse contribution from this
+        // point light.
+        lightColor = add(
+            lightColor,
+            multiply(
+                materialColor,
+                intensity * light->mIntensity * diffuse * facing
+            )
+        );
+    }
+
+    return divide(lightColor, (float) shadowSamples);
+}
+
+
+/**
+ * A cheap estimate of how much a light contributes to a hit, ignoring
+ * shadows. Shading has no distance falloff, so this is the light's intensity
+ * times how much of the light is in front of the surface. It is only zero
+ * when no part of the light's sphere faces the surface, so that every light
+ * that could contribute can be picked.
+ */
+float RenderThread::estimateLightContribution(const Hit &hit, PointLight *light) {
+    if (!light->reaches(hit.position, hit.normal, mRenderer->mEnableSoftShadows)) {
+        return 0;
+    }
+
+    Vec3f toLight = subtract(light->mPosition, hit.position);
+    float distance = sqrtf(dot(toLight, toLight));
+    if (distance <= light->mRadius) {
+        return light->mIntensity;
+    }
+
+    float radius = mRenderer->mEnableSoftShadows ? light->mRadius : 0;
+    float facing = fmin(1, (dot(toLight, hit.normal) + radius) / distance);
+    return light->mIntensity * fmax(0, facing);
+}
+
+
+/**
+ * Shades a hit with a few lights picked at random instead of every light,
+ * so the cost of a hit does not grow with the number of lights. Each light
+ * sample draws LIGHT_CANDIDATES candidates from the scene's alias table,
+ * which picks lights in proportion to their intensity, and keeps one in
+ * proportion to its estimated contribution at this hit. This is resampled
+ * importance sampling [16]: weighting the kept light by the mean of the
+ * candidates' weights over its estimate keeps the result unbiased, as long
+ * as the estimate is never zero where a light contributes.
+ */
+Vec3f RenderThread::sampleLights(const Hit &hit, Vec3f materialColor, int depth) {
+    const AliasTable &table = mRenderer->mLightTable;
+    int lightSamples = mRenderer->mLightSamples;
+
+    Vec3f color({ 0, 0, 0 });
+    for (int k = 0; k < lightSamples; k++) {
+        int dimension = LIGHT_DIMENSION + LIGHT_SAMPLE_DIMENSIONS * (depth * lightSamples + k);
+        // The candidates are stratified over the alias table, which keeps
+        // each of them distributed like the table.
+        float candidateSample = mSampler->get(dimension + 3);
+        int candidates[LIGHT_CANDIDATES];
+        float estimates[LIGHT_CANDIDATES];
+        float weights[LIGHT_CANDIDATES];
+        float weightSum = 0;
+        for (int j = 0; j < LIGHT_CANDIDATES; j++) {
+            float pdf;
+            candidates[j] = table.sample((j + candidateSample) / LIGHT_CANDIDATES, pdf);
+            estimates[j] = estimateLightContribution(hit, mRenderer->mScene.mPointLights[candidates[j]].get());
+            weights[j] = pdf > 0 ? estimates[j] / pdf : 0;
+            weightSum += weights[j];
+        }
+        if (weightSum <= 0) {
+            continue;
+        }
+
+        float target = mSampler->get(dimension + 4) * weightSum;
+        int chosen = LIGHT_CANDIDATES - 1;
+        for (int j = 0; j < LIGHT_CANDIDATES; j++) {
+            target -= weights[j];
+            if (target < 0 && weights[j] > 0) {
+                chosen = j;
+                break;
+            }
+        }
+        while (weights[chosen] <= 0) {
+            chosen--;
+        }
+
+        Vec3f lightColor = shadeLight(
+            hit,
+            mRenderer->mScene.mPointLights[candidates[chosen]].get(),
+            getLightSample(dimension),
+            materialColor
+        );
+        float weight = weightSum / (LIGHT_CANDIDATES * estimates[chosen]);
+        color = add(color, multiply(lightColor, weight));
+    }
+
+    return divide(color, (float) lightSamples);
+}
+
+
+/**
+ * Computes the color of a ray from what it hit. The color is determined by
+ * the material properties of the object this ray intersects. This is the sum
+ * of the following components, each scaled by a coefficient defined by the
+ * material.
+ *
+ *   - Ambient, independent of lighting and recursive calls
+ *   - Diffuse, dependent on lighting
+ *   - Specular, dependent on a recursive `trace` call for reflections
+ *   - Transmission, dependent on a recursive `trace` call for refraction
+ */
+Vec3f RenderThread::shade(const Hit &hit, Vec3f ray, int depth) {
+    SceneObject *intersectionObject = hit.object;
+    Vec3f intersection = hit.position;
+    Vec3f normal = hit.normal;
     // The object is responsible for computing its color at a certain point on
     // its surface.
-    Vec3f materialColor = intersectionObject->getColor(REST(intersection));
+    Vec3f materialColor = intersectionObject->getColor(REST(intersection), hit.footprint);
     // The color will always start with its ambient component.
     Vec3f color = multiply(materialColor, intersectionObject->mMaterial->ambient);
 
     float diffuse = intersectionObject->mMaterial->diffuse;
     if (diffuse > 0) {
         // Every point light in the scene contributes to the color contributed
-        // from this ray. A shadow ray is computed by the point light and used
-        // to see if the light visible from the object. There may be an object
-        // in between the intersection point and every light in the scene, in
-        // which case the point is in shadow and no diffuse component
-        // contributes to the final color.
-        for (auto pointLight : mRenderer->mScene.mPointLights) {
-            float distance;
-            Vec3f shadowRay = pointLight->direction(
-                intersection,
-                distance,
-                mRenderer->mEnableSoftShadows
-            );
-            mStats.quantities[SHADOW]++;
-
-            float k;
-            // Intersecting with an object that isn't 100% transparent or 100%
-            // opaque means that a fraction of this point light intensity
-            // contributes to the color. The intensity starts at 1 and each
-            // time an object is intersected along the ray's path to the light
-            // source, the intensity drops based on the intersection's
-            // transparency.
-            float intensity = 1;
-            for (auto testObj : mRenderer->mScene.mObjects) {
-                if (testObj == intersectionObject) {
-                    continue;
-                }
-                // We need to check for just a smidge of bias to ensure we're not
-                // intersecting with testObj. We also need to ensure that the
-                // distance to the object is less than the distance to the light,
-                // since the light could be between the two objects (especially
-                // with planes where there is usually an intersection with the
-                // ray).
-                if (testObj->intersect(intersection, shadowRay, k) && k >= 1e-4 && k < distance) {
-                    intensity -= 1 - fmax(0, testObj->mMaterial->transmission);
-                    // We can stop testing objects once the intensity drops
-                    // below 0, since it can never increase.
-                    if (intensity <= 1e-4) {
-                        break;
-                    }
-                }
+        // from this ray, unless there are more lights than light samples and
+        // only a few of them are picked to stand in for the rest.
+        int numLights = mRenderer->mScene.mPointLights.size();
+        int lightSamples = mRenderer->mLightSamples;
+        if (lightSamples > 0 && lightSamples < numLights) {
+            color = add(color, sampleLights(hit, materialColor, depth));
+        } else {
+            for (int lightIndex : mRenderer->mLightIndex.query(intersection)) {
+                // Every light at every depth needs its own sample dimensions.
+                int dimension = LIGHT_DIMENSION + 3 * (depth * numLights + lightIndex);
+                color = add(color, shadeLight(
+                    hit,
+                    mRenderer->mScene.mPointLights[lightIndex].get(),
+                    getLightSample(dimension),
+                    materialColor
+                ));
             }
-
-            // Use the facing ratio, the shadow intensity computed, the diffuse
-            // coefficient of the material, and the facing ratio of the shadow
-            // ray and normal to compute the final diffuse contribution from
-            // this point light.
-            color = add(
-                color,
-                multiply(
-                    materialColor,
-                    intensity * pointLight->mIntensity * diffuse * fmax(0, dot(shadowRay, normal))
-                )
-            );
         }
     }
 
@@ -391,13 +1704,15 @@ Vec3f RenderThread::trace(Vec3f origin, Vec3f ray, int depth) {
             Vec3f transmissionColor = trace(
                 add(intersection, multiply(transmissionDirection, 1e-4)),
                 transmissionDirection,
-                depth + 1
+                depth + 1,
+                hit.coneWidth
             );
             color = add(
                 color,
                 multiply(transmissionColor, intersectionObject->mMaterial->transmission)
             );
             mStats.quantities[TRANSMISSION]++;
+            mSawTransmission = true;
         }
     }
 
@@ -413,7 +1728,8 @@ Vec3f RenderThread::trace(Vec3f origin, Vec3f ray, int depth) {
         Vec3f reflectionColor = trace(
             add(intersection, multiply(reflectionDirection, 1e-5)),
             reflectionDirection,
-            depth + 1
+            depth + 1,
+            hit.coneWidth
         );
         color = add(
             color,
@@ -491,22 +1807,93 @@ Vec3f computeRefractionDir(Vec3f ray, Vec3f normal, float refractionIndex, bool
 void Renderer::printIntro(std::string file) {
     // This is so gross and should be refactored.
     std::cout << "=== Render Info " << file << " ===" << std::endl;
-    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Target" << "OpenGL, " << mOutputFile << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Target" << (mIsHeadless ? "" : "OpenGL, ") << mOutputFile << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Framebuffer"
+              << (mFramebufferFormat == HALF_RGB ? "Half" : mFramebufferFormat == RGBE ? "RGBE" : "Float") << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Stream Output?" << (mEnableStreamingOutput ? "Yes" : "No") << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Gamma" << mGamma << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Dither?" << (mEnableDither ? "Yes" : "No") << std::endl;
     std::cout << std::left << std::setw(20) << std::setfill(' ') << "Image Dimension" << mWidth << " x " << mHeight << std::endl;
+    if (mEnableCrop) {
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Crop"
+                  << mCropX0 << ", " << mCropY0 << " to " << mCropX1 << ", " << mCropY1
+                  << (mCompositeFile.empty() ? "" : " over " + mCompositeFile) << std::endl;
+    }
+    if (mNumParts > 1) {
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Tiles" << "Part " << mPart << " of " << mNumParts << std::endl;
+    }
     std::cout << std::left << std::setw(20) << std::setfill(' ') << "Threads" << mNumThreads << std::endl;
     std::cout << std::left << std::setw(20) << std::setfill(' ') << "Max Depth" << mMaxDepth << std::endl;
     std::cout << std::left << std::setw(20) << std::setfill(' ') << "Anti-Aliasing" << mAntiAliasing << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Adaptive AA?";
+    if (mEnableAdaptiveAntiAliasing) {
+        std::cout << "Yes (contrast " << mContrastThreshold << ")";
+    } else {
+        std::cout << "No";
+    }
+    std::cout << std::endl;
     std::cout << std::left << std::setw(20) << std::setfill(' ') << "Sampling Method";
     if (mAntiAliasing == 0) {
         std::cout << "Off";
-    } else if (mAntiAliasingMethod == REGULAR) {
+    } else if (mSamplingMethod == REGULAR) {
         std::cout << "Regular";
-    } else if (mAntiAliasingMethod == RANDOM) {
+    } else if (mSamplingMethod == RANDOM) {
         std::cout << "Random";
+    } else if (mSamplingMethod == SOBOL) {
+        std::cout << "Sobol";
+    } else if (mSamplingMethod == HALTON) {
+        std::cout << "Halton";
+    } else if (mSamplingMethod == R2) {
+        std::cout << "R2";
     }
     std::cout << std::endl;
     std::cout << std::left << std::setw(20) << std::setfill(' ') << "Soft Shadows?" << (mEnableSoftShadows ? "Yes" : "No") << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Filter Textures?" << (mEnableTextureFiltering ? "Yes" : "No") << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Light Samples";
+    if (mLightSamples > 0 && mLightSamples < (int) mScene.mPointLights.size()) {
+        std::cout << mLightSamples << " of " << mScene.mPointLights.size();
+    } else {
+        std::cout << "All";
+    }
+    std::cout << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Adaptive Shadows?";
+    if (mEnableAdaptiveShadows) {
+        std::cout << "Yes (" << mShadowProbes << " probes)";
+    } else {
+        std::cout << "No";
+    }
+    std::cout << std::endl;
     std::cout << std::left << std::setw(20) << std::setfill(' ') << "Iterations" << mNoiseReduction << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Adaptive DOF?" << (mEnableAdaptiveDepthOfField ? "Yes" : "No") << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Progressive?";
+    if (mConvergenceThreshold > 0) {
+        std::cout << "Yes (threshold " << mConvergenceThreshold << ")";
+    } else if (isProgressive()) {
+        std::cout << "Yes";
+    } else {
+        std::cout << "No";
+    }
+    std::cout << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Time Budget";
+    if (mTimeBudgetSeconds > 0) {
+        std::cout << mTimeBudgetSeconds << "s";
+    } else {
+        std::cout << "None";
+    }
+    std::cout << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Denoise?" << (mEnableDenoising ? "Yes" : "No") << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "AOVs";
+    if (mAovChannels.empty()) {
+        std::cout << "None";
+    }
+    for (size_t i = 0; i < mAovChannels.size(); i++) {
+        std::cout << (i > 0 ? ", " : "") << getAovName(mAovChannels[i]);
+    }
+    std::cout << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Cache Primary Hits?" << (shouldCachePrimaryHits() ? "Yes" : "No") << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Cost Pre-Pass?" << (mEnableCostPrePass ? "Yes" : "No") << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "NUMA Placement?" << (mEnableNumaPlacement ? "Yes" : "No") << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Huge Pages?" << (mEnableHugePages ? "Yes" : "No") << std::endl;
     std::cout << std::endl;
     std::cout << std::left << std::setw(20) << std::setfill(' ') << "Field of View" << mScene.mCamera.mFieldOfViewRadians * 180.0f / M_PI << std::endl;
     std::cout << std::left << std::setw(20) << std::setfill(' ') << "Eye"
@@ -11,20 +11,78 @@
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
+#include "Aovs.h"
+#include "Denoiser.h"
+#include "Framebuffer.h"
+#include "ImageFile.h"
+#include "LightIndex.h"
+#include "Sampler.h"
 #include "Scene.h"
 #include "Stats.h"
+#include "Utility.h"
 #include "Vector.h"
 
 
+/// Adaptive depth of field measures each pixel's blur over this many
+/// iterations, which is all an in-focus pixel gets.
+#define MIN_DEPTH_OF_FIELD_ITERATIONS 2
+
+
 Vec3f computeReflectionDir(Vec3f incomingRayDirection, Vec3f surfaceNormal);
 Vec3f computeRefractionDir(Vec3f ray, Vec3f normal, float refractionIndex, bool &isTotalInternalReflection);
 bool isInside(Vec3f rayDirection, Vec3f intersectionNormal);
 
 
-enum AntiAliasingMethod {
-    REGULAR,
-    RANDOM
+/**
+ * A rectangular block of pixels that a render thread renders as a single job.
+ * Both corners are inclusive.
+ */
+struct Tile {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+    /// Estimated cost of rendering this tile, filled in by the cost pre-pass.
+    float cost;
+    /// Set once every pixel of the tile has converged in a progressive render.
+    bool converged;
+
+    int area() const;
+};
+
+
+/// A copy of a finished tile's pixels, so the preview never reads pixels that
+/// the render threads may be writing.
+struct TileSnapshot {
+    Tile tile;
+    std::vector<Vec3f> pixels;
+};
+
+
+/**
+ * Everything shading needs to know about where a ray hit an object, so that
+ * a hit can be shaded again without intersecting the scene again.
+ */
+struct Hit {
+    SceneObject *object;
+    float distance;
+    Vec3f position;
+    Vec3f normal;
+    /// The width of the ray's cone where it hits.
+    float coneWidth;
+    /// How wide the cone's footprint on the surface is along each axis.
+    Vec3f footprint;
+};
+
+
+/// A primary ray and what it hit, kept for later iterations of a pixel.
+struct PrimarySample {
+    bool isCached;
+    bool doesIntersect;
+    Vec3f direction;
+    Hit hit;
 };
 
 
@@ -37,37 +95,168 @@ enum AntiAliasingMethod {
  */
 class Renderer {
     private:
-        /// Maintain a queue of render jobs to be performed.
-        std::queue<std::pair<int, int>> mWorkQueue;
+        /// Maintain a queue of render jobs (indices into mTiles) to be
+        /// performed for each NUMA node.
+        std::vector<std::queue<int>> mWorkQueues;
         /// Prevent interference between threads on the work queue.
         std::mutex mQueueLock;
-        /// Track the number of rows completed by the render threads for the progress bar.
-        int mCompletedRows;
+        /// Track the number of pixels completed by the render threads for the progress bar.
+        int64_t mCompletedPixels;
+        /// The number of pixels in the tiles queued for the current pass.
+        int64_t mQueuedPixels;
         /// The final image is ultimately just an array of color vectors.
-        Vec3f *mImage;
+        Framebuffer *mImage;
+        /// The CPUs of each NUMA node render threads are spread over. This
+        /// is a single node with no CPUs when NUMA placement is off.
+        std::vector<std::vector<int>> mNumaNodeCpus;
+        /// Per pixel sample counts and sums of squared luminance deviations
+        /// for progressive rendering. mImage holds the running means.
+        std::vector<int> mSampleCounts;
+        std::vector<float> mSumSquares;
+        /// Bytes rather than bits, as threads set neighbouring pixels at once.
+        std::vector<char> mConverged;
+        /// The mean standard error of the unconverged pixels, used to share
+        /// out samples in a time budgeted render.
+        float mMeanStandardError;
+        /// When a time budgeted render has to stop.
+        TimePoint mDeadline;
+        /// The pixels being rendered: the crop window, or the whole image.
+        Tile mRegion;
+        /// Tiles finished since the preview last looked, when previewing.
+        std::vector<TileSnapshot> mFinishedTiles;
+        std::mutex mPreviewLock;
+
+        float computeStandardError(size_t i);
+        void updateMeanStandardError();
+
+        void buildTiles();
+        void estimateTileCosts(float aspectRatio, float fovRatio);
+        void balanceTiles();
+        int64_t enqueueTiles();
+        int getNumaNode(int y);
 
     public:
         Scene &mScene;
+        /// The image divided into render jobs.
+        std::vector<Tile> mTiles;
         int mWidth;
         int mHeight;
-        /// Number of rendering iterations to run and average.
+        /// Only render the pixels from (mCropX0, mCropY0) to (mCropX1,
+        /// mCropY1) inclusive, and write just those unless compositing.
+        bool mEnableCrop;
+        int mCropX0;
+        int mCropY0;
+        int mCropX1;
+        int mCropY1;
+        /// A full size PPM to write a cropped render over instead. Empty
+        /// writes the crop on its own.
+        std::string mCompositeFile;
+        /// Only render part mPart of mNumParts of the tiles, and write them
+        /// to a partial image for merging with the other parts. One part
+        /// renders the whole image as usual.
+        int mPart;
+        int mNumParts;
+        /// Number of rendering iterations to run and average. This is the
+        /// maximum number of passes when rendering progressively.
         int mNoiseReduction;
+        /// Render progressively, one sample per pixel per pass, and stop
+        /// sampling a pixel once the 95% confidence interval of its mean
+        /// luminance is narrower than this. Zero turns it off.
+        float mConvergenceThreshold;
+        /// Keep rendering progressive passes until this many seconds have
+        /// passed, then write the image as it is. Zero turns it off.
+        float mTimeBudgetSeconds;
+        /// The pass currently being rendered.
+        int mPass;
         int mMaxDepth;
         /// Must be a square number.
         int mAntiAliasing;
-        AntiAliasingMethod mAntiAliasingMethod;
+        /// Only trace every anti-aliasing sample for pixels that need them.
+        bool mEnableAdaptiveAntiAliasing;
+        /// The contrast above which an adaptive pixel is refined.
+        float mContrastThreshold;
+        /// How anti-aliasing, lens, and soft shadow samples are placed.
+        SamplingMethod mSamplingMethod;
         bool mEnableSoftShadows;
+        /// Filter textures over the footprint of each ray.
+        bool mEnableTextureFiltering;
+        /// Trace a few probe shadow rays to each light first, and only trace
+        /// all of its shadow samples when the probes disagree.
+        bool mEnableAdaptiveShadows;
+        /// Give in-focus pixels only a few iterations and strongly
+        /// defocused pixels all of them.
+        bool mEnableAdaptiveDepthOfField;
+        /// The number of probe shadow rays per light.
+        int mShadowProbes;
+        /// Shade each hit with this many lights picked by importance instead
+        /// of every light. Zero uses every light.
+        int mLightSamples;
+        /// Picks lights in proportion to their intensity.
+        AliasTable mLightTable;
+        /// Finds the lights that can reach a point.
+        LightIndex mLightIndex;
+        /// Allow primary hits to be reused when they are worth caching.
+        bool mEnablePrimaryHitCache;
+        /// Reuse primary hits between the iterations of a pixel. Decided
+        /// when the render starts.
+        bool mCachePrimaryHits;
+        /// Filter the noise out of the image once it is rendered.
+        bool mEnableDenoising;
+        /// Gathers the guides for the denoiser while rendering, when
+        /// denoising.
+        Denoiser *mDenoiser;
+        /// The extra channels to write alongside the image.
+        std::vector<AovChannel> mAovChannels;
+        /// Gathers the extra channels while rendering, when any are
+        /// requested.
+        Aovs *mAovs;
+        /// Render a low resolution pre-pass to order the tiles by cost.
+        bool mEnableCostPrePass;
+        /// Pin threads to NUMA nodes and place the image rows each node
+        /// renders in that node's memory.
+        bool mEnableNumaPlacement;
+        /// Advise the kernel to back large framebuffers with huge pages.
+        bool mEnableHugePages;
         int mNumThreads;
         std::string mOutputFile;
+        /// How the image is stored while it is rendered.
+        FramebufferFormat mFramebufferFormat;
+        /// Write each tile to the output file as soon as it is finished,
+        /// instead of keeping the whole image in memory.
+        bool mEnableStreamingOutput;
+        /// The output file tiles are written to, when streaming.
+        ImageStream *mStream;
+        /// The gamma the image is encoded with. One leaves it linear.
+        float mGamma;
+        /// Dither the image as it is quantized to 8 bits per channel.
+        bool mEnableDither;
+        /// Only write the image, without a window to show it in.
+        bool mIsHeadless;
+        /// Keep track of finished tiles for a live preview of the render.
+        bool mEnablePreview;
 
         Renderer(Scene &scene);
         ~Renderer();
-        bool getWork(int &start, int &end);
+        bool getWork(int &tileIndex, int node);
+        bool isProgressive();
+        bool hasStochasticPrimaryRays();
+        bool hasStochasticShading();
+        int getIterations();
+        bool shouldCachePrimaryHits();
+        bool isOutOfTime();
+        bool isConverged(int x, int y);
+        int getSampleCount(int x, int y);
+        int getSamplesThisPass(int x, int y);
+        bool accumulateSample(int x, int y, Vec3f color);
+        int placeThread(int id);
+        void touchFramebuffer(int id, int node);
         void printProgress();
         void printIntro(std::string file);
 
         void render();
-        void gl();
+        const Framebuffer *getImage() const;
+        void finishTile(const Tile &tile);
+        std::vector<TileSnapshot> takeFinishedTiles();
 };
 
 
@@ -82,11 +271,22 @@ class Renderer {
  */
 class RenderThread {
     private:
-        void computePrimaryRay(int x, int y, float xS, float yS, Vec3f &direction, Vec3f &origin);
-        Vec3f renderPixel(int x, int y);
-        Vec3f trace(Vec3f origin, Vec3f ray, int depth);
-        Vec3f computePixelAverage(int x, int y);
-        void computeAntiAliasingSample(int samples, int x, int y, float &xS, float &yS);
+        void computePrimaryRay(int x, int y, float xS, float yS, float lensU, float lensV, Vec3f &direction, Vec3f &origin);
+        void computePrimaryFootprint(int x, int y, float xS, float yS, float lensU, float lensV, Hit &hit);
+        Vec3f renderPixel(int x, int y, int iteration);
+        Vec3f renderAdaptivePixel(int x, int y, int iteration);
+        Vec3f renderSample(int x, int y, uint32_t index);
+        Vec3f trace(Vec3f origin, Vec3f ray, int depth, float coneWidth);
+        bool intersect(Vec3f origin, Vec3f ray, float coneWidth, Hit &hit);
+        Vec3f shade(const Hit &hit, Vec3f ray, int depth);
+        float traceShadowRay(SceneObject *ignore, Vec3f origin, Vec3f ray, float distance);
+        bool probeShadows(const Hit &hit, PointLight *light, float offset, float &intensity);
+        Vec3f getLightSample(int dimension);
+        float estimateLightContribution(const Hit &hit, PointLight *light);
+        Vec3f sampleLights(const Hit &hit, Vec3f materialColor, int depth);
+        void addRayCounts(int x, int y, const int64_t *before);
+        int computeDepthOfFieldIterations();
+        int64_t countRays();
 
     public:
         Renderer *mRenderer;
@@ -94,10 +294,38 @@ class RenderThread {
         float mAspectRatio;
         float mFovRatio;
         std::shared_ptr<std::thread> mThread;
+        /// This thread's own sampler for every stochastic decision.
+        std::shared_ptr<Sampler> mSampler;
+        /// The NUMA node this thread runs on.
+        int mNode;
+        /// The image and tile currently being rendered.
+        Framebuffer *mImage;
+        const Tile *mTile;
+        /// Set by `trace` whenever a transmission ray is traced.
+        bool mSawTransmission;
+        /// Which anti-aliasing samples of the current pixel have been traced.
+        std::vector<bool> mSampleTaken;
+        /// The primary rays of the current pixel when primary hits are cached.
+        std::vector<PrimarySample> mPrimarySamples;
+        /// The largest blur of the current pixel's primary hits, in pixels.
+        float mCircleOfConfusion;
+        /// How much wider a ray's cone gets per unit of distance, when
+        /// textures are filtered.
+        float mConeSpread;
 
         RenderThread(Renderer *renderer, float aspectRatio, float fovRatio);
-        void run(Vec3f *image, const int id);
-        void render(Vec3f *image, const int id);
+        /// Plain `new` only honours the cache line alignment of mStats from
+        /// C++17 onwards.
+        static void *operator new(size_t size);
+        static void operator delete(void *pointer);
+        void run(Framebuffer *image, const int id);
+        void runPrePass(const int id);
+        void runTouch(const int id);
+        void render(Framebuffer *image, const int id);
+        void estimateCosts(const int id);
+        void touchFramebuffer(const int id);
+        Vec3f shadeLight(const Hit &hit, PointLight *light, Vec3f sample, Vec3f materialColor);
+        Vec3f computePixelAverage(int x, int y);
         void join();
 };
 
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Random.h"
+#include "Sampler.h"
+#include "Vector.h"
+
+
+/// The largest float below 1, to keep values within [0, 1).
+#define ONE_MINUS_EPSILON 0.99999994f
+
+
+/// Enough primes for every dimension a sampler is likely to be asked for.
+const int primes[] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67,
+    71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149,
+    151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229,
+    233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+};
+const int numPrimes = sizeof(primes) / sizeof(primes[0]);
+
+
+float toUnitFloat(uint32_t bits) {
+    return fminf(bits * (1.0f / 4294967296.0f), ONE_MINUS_EPSILON);
+}
+
+
+Sampler::Sampler()
+: mPixel(0)
+, mIndex(0)
+, mRandom()
+{}
+
+
+void Sampler::startSample(uint64_t pixel, uint32_t index) {
+    mPixel = pixel;
+    mIndex = index;
+    mRandom.seed(pixel, index, 0);
+}
+
+
+/// Random bits that are fixed for a pixel and dimension.
+uint32_t Sampler::scramble(int dimension) {
+    return (uint32_t) mixBits(mixBits(mPixel) ^ ((uint64_t) dimension + 1));
+}
+
+
+float RandomSampler::get(int dimension) {
+    return mRandom.nextFloat();
+}
+
+
+RegularSampler::RegularSampler(int gridSize)
+: Sampler()
+, mGridSize(gridSize < 1 ? 1 : gridSize)
+{}
+
+
+float RegularSampler::get(int dimension) {
+    int cell = mIndex % (mGridSize * mGridSize);
+    if (dimension == PIXEL_DIMENSION) {
+        return (cell % mGridSize) / (float) mGridSize;
+    } else if (dimension == PIXEL_DIMENSION + 1) {
+        return (cell / mGridSize) / (float) mGridSize;
+    }
+
+    return mRandom.nextFloat();
+}
+
+
+/// Base 2 radical inverse: the bits of the index mirrored about the point.
+uint32_t vanDerCorput(uint32_t index) {
+    index = (index << 16) | (index >> 16);
+    index = ((index & 0x00ff00ff) << 8) | ((index & 0xff00ff00) >> 8);
+    index = ((index & 0x0f0f0f0f) << 4) | ((index & 0xf0f0f0f0) >> 4);
+    index = ((index & 0x33333333) << 2) | ((index & 0xcccccccc) >> 2);
+    index = ((index & 0x55555555) << 1) | ((index & 0xaaaaaaaa) >> 1);
+    return index;
+}
+
+
+/// The second dimension of the Sobol sequence.
+uint32_t sobolSecondDimension(uint32_t index) {
+    uint32_t v = 1u << 31;
+    uint32_t result = 0;
+    for (; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1) {
+            result ^= v;
+        }
+    }
+    return result;
+}
+
+
+float SobolSampler::get(int dimension) {
+    int pair = dimension / 2;
+    // XOR with a fixed mask permutes the indices within every power of two
+    // block, which keeps the stratification of the sequence.
+    uint32_t index = mIndex ^ (scramble(-1 - pair) & 0xffff);
+    uint32_t bits = (dimension % 2 == 0) ? vanDerCorput(index) : sobolSecondDimension(index);
+    return toUnitFloat(bits ^ scramble(dimension));
+}
+
+
+float radicalInverse(int base, uint32_t index) {
+    double inverseBase = 1.0 / base;
+    double inverse = inverseBase;
+    double result = 0;
+    while (index > 0) {
+        result += (index % base) * inverse;
+        index /= base;
+        inverse *= inverseBase;
+    }
+    return (float) result;
+}
+
+
+float HaltonSampler::get(int dimension) {
+    if (dimension >= numPrimes) {
+        return mRandom.nextFloat();
+    }
+
+    float value = radicalInverse(primes[dimension], mIndex) + toUnitFloat(scramble(dimension));
+    return fminf(value - floorf(value), ONE_MINUS_EPSILON);
+}
+
+
+float R2Sampler::get(int dimension) {
+    // The plastic number g is the root of g^3 = g + 1.
+    const double g = 1.32471795724474602596;
+    const double alpha[] = { 1.0 / g, 1.0 / (g * g) };
+
+    int pair = dimension / 2;
+    uint32_t index = mIndex ^ (scramble(-1 - pair) & 0xffff);
+    double value = alpha[dimension % 2] * index + toUnitFloat(scramble(dimension));
+    return fminf((float) (value - floor(value)), ONE_MINUS_EPSILON);
+}
+
+
+/**
+ * Point `index` of `count` points spread evenly over the unit cube and
+ * shifted by `shift`, for drawing several samples from one sample's
+ * dimensions. The first dimension puts exactly one point in each of `count`
+ * equal strata and the other two follow the R2 recurrence [13], so the points
+ * are stratified however many there are. The first point is `shift` itself.
+ */
+Vec3f stratifiedPoint(Vec3f shift, int index, int count) {
+    const double g = 1.32471795724474602596;
+    double values[] = {
+        shift[0] + index / (double) count,
+        shift[1] + index / g,
+        shift[2] + index / (g * g)
+    };
+
+    Vec3f point;
+    for (int i = 0; i < 3; i++) {
+        point[i] = fminf((float) (values[i] - floor(values[i])), ONE_MINUS_EPSILON);
+    }
+    return point;
+}
+
+
+AliasTable::AliasTable()
+: mThresholds()
+, mAliases()
+, mProbabilities()
+{}
+
+
+/**
+ * Vose's construction: columns of items with less than the average weight are
+ * topped up by an item with more, which then goes back in whichever list its
+ * remaining weight belongs to. Items with no weight are never picked unless
+ * every item has none, in which case they are picked uniformly.
+ */
+void AliasTable::build(const std::vector<float> &weights) {
+    int n = weights.size();
+    double total = 0;
+    for (float weight : weights) {
+        total += weight;
+    }
+
+    mThresholds.assign(n, 1);
+    mAliases.resize(n);
+    mProbabilities.resize(n);
+    std::vector<double> scaled(n);
+    std::vector<int> small;
+    std::vector<int> large;
+    for (int i = 0; i < n; i++) {
+        mAliases[i] = i;
+        mProbabilities[i] = total > 0 ? weights[i] / total : 1.0 / n;
+        scaled[i] = mProbabilities[i] * n;
+        if (scaled[i] < 1) {
+            small.push_back(i);
+        } else {
+            large.push_back(i);
+        }
+    }
+
+    while (!small.empty() && !large.empty()) {
+        int s = small.back();
+        small.pop_back();
+        int l = large.back();
+        mThresholds[s] = scaled[s];
+        mAliases[s] = l;
+        scaled[l] -= 1 - scaled[s];
+        if (scaled[l] < 1) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Whatever is left over only misses 1 by rounding error.
+    for (int i : small) {
+        mThresholds[i] = 1;
+    }
+    for (int i : large) {
+        mThresholds[i] = 1;
+    }
+}
+
+
+int AliasTable::sample(float u, float &pdf) const {
+    int n = mThresholds.size();
+    float scaled = u * n;
+    int column = std::min(n - 1, (int) scaled);
+    int item = scaled - column < mThresholds[column] ? column : mAliases[column];
+    pdf = mProbabilities[item];
+    return item;
+}
+
+
+size_t AliasTable::size() const {
+    return mThresholds.size();
+}
+
+
+std::shared_ptr<Sampler> createSampler(SamplingMethod method, int gridSize) {
+    switch (method) {
+        case REGULAR:
+            return std::make_shared<RegularSampler>(gridSize);
+        case SOBOL:
+            return std::make_shared<SobolSampler>();
+        case HALTON:
+            return std::make_shared<HaltonSampler>();
+        case R2:
+            return std::make_shared<R2Sampler>();
+        case RANDOM:
+        default:
+            return std::make_shared<RandomSampler>();
+    }
+}
@@ -0,0 +1,146 @@
+/**
+ * @file
+ * @brief Sampler and its subclasses hand out the sample values used to place
+ *        anti-aliasing samples, lens points, and soft shadow jitter.
+ */
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Random.h"
+#include "Vector.h"
+
+
+enum SamplingMethod {
+    REGULAR,
+    RANDOM,
+    SOBOL,
+    HALTON,
+    R2
+};
+
+
+/// Dimensions 0 and 1 place a sample within its pixel.
+#define PIXEL_DIMENSION 0
+/// Dimensions 2 and 3 place a sample on the lens.
+#define LENS_DIMENSION 2
+/// Every light at every bounce gets three dimensions from here on.
+#define LIGHT_DIMENSION 4
+/// When lights are picked at random, every light sample at every bounce gets
+/// this many dimensions instead: three to place the light sample and two to
+/// pick the light.
+#define LIGHT_SAMPLE_DIMENSIONS 5
+
+
+/**
+ * A sampler produces every sample of a pixel as a point in the unit
+ * hypercube, one dimension per decision made while rendering the sample. The
+ * samples of a pixel are spread evenly over each dimension so that fewer of
+ * them are needed to reach the same noise level as independent random
+ * numbers. Each pixel gets its own scrambling of the sequence so that
+ * neighbouring pixels do not share the same pattern.
+ *
+ * Call `startSample` before each sample and then `get` for each dimension.
+ */
+class Sampler {
+    protected:
+        uint64_t mPixel;
+        uint32_t mIndex;
+        /// Fallback for dimensions a sampler does not have a sequence for.
+        Random mRandom;
+
+        uint32_t scramble(int dimension);
+
+    public:
+        Sampler();
+        virtual ~Sampler() = default;
+
+        /// Begin sample `index` of the pixel numbered `pixel`.
+        void startSample(uint64_t pixel, uint32_t index);
+        /// The value of the current sample in `dimension`, in [0, 1).
+        virtual float get(int dimension) = 0;
+};
+
+
+/// Independent uniform random numbers for every dimension.
+class RandomSampler : public Sampler {
+    public:
+        float get(int dimension);
+};
+
+
+/**
+ * Places the pixel samples on a `gridSize` by `gridSize` grid. Every other
+ * dimension is random.
+ */
+class RegularSampler : public Sampler {
+    private:
+        int mGridSize;
+
+    public:
+        RegularSampler(int gridSize);
+        float get(int dimension);
+};
+
+
+/**
+ * Pairs of dimensions are drawn from the first two dimensions of the Sobol
+ * sequence, which form a (0, 2)-sequence. Every pair and every pixel shuffles
+ * the sample order and scrambles the digits differently so the pairs are not
+ * correlated with each other. Based on [12].
+ */
+class SobolSampler : public Sampler {
+    public:
+        float get(int dimension);
+};
+
+
+/**
+ * Each dimension is the radical inverse of the sample index in a different
+ * prime base, shifted randomly per pixel. Based on [12].
+ */
+class HaltonSampler : public Sampler {
+    public:
+        float get(int dimension);
+};
+
+
+/**
+ * Pairs of dimensions come from the R2 additive recurrence built on the
+ * plastic number, shifted and shuffled per pixel and per pair. Based on [13].
+ */
+class R2Sampler : public Sampler {
+    public:
+        float get(int dimension);
+};
+
+
+/**
+ * Walker's alias method [17] picks one of n items with probability
+ * proportional to its weight in constant time, from one sample value. Each of
+ * n equally likely columns holds an item and the alias that fills the rest
+ * of the column.
+ */
+class AliasTable {
+    private:
+        std::vector<float> mThresholds;
+        std::vector<int> mAliases;
+        std::vector<float> mProbabilities;
+
+    public:
+        AliasTable();
+        void build(const std::vector<float> &weights);
+        /// Picks an item with `u` in [0, 1) and sets `pdf` to its probability.
+        int sample(float u, float &pdf) const;
+        size_t size() const;
+};
+
+
+std::shared_ptr<Sampler> createSampler(SamplingMethod method, int gridSize);
+Vec3f stratifiedPoint(Vec3f shift, int index, int count);
+
+
+#endif
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <map>
 #include <memory>
+#include <stdexcept>
 #include <utility>
 
 #include "Material.h"
@@ -168,6 +169,16 @@ std::shared_ptr<PointLight> getLight(FloatProperties properties) {
     ASSIGN_VEC3F("position", light->mPosition, properties, i);
     ASSIGN_FLOAT("intensity", light->mIntensity, properties, i);
     ASSIGN_FLOAT("radius", light->mRadius, properties, i);
+    i = properties.find("shadowSamples");
+    if (i != properties.end()) {
+        float samples = i->second.size() == 1 ? i->second.at(0) : 0;
+        if (!(samples >= 1 && samples <= 1 << 20) || std::floor(samples) != samples) {
+            std::cout << "Invalid shadowSamples. Must be a whole number of at least 1." << std::endl;
+            throw "Invalid shadowSamples. Must be a whole number of at least 1.";
+        }
+        light->mShadowSamples = (int) samples;
+    }
+    ASSIGN_FLOAT("influenceRadius", light->mInfluenceRadius, properties, i);
 
     return light;
 }
@@ -281,6 +292,223 @@ bool parseObject(std::vector<std::shared_ptr<SceneObject>> &objects, Materials &
 }
 
 
+void assignRendererProperty(Renderer &renderer, std::string key, std::string value) {
+    if (key == "width") {
+        renderer.mWidth = std::stoi(value);
+    } else if (key == "height") {
+        renderer.mHeight = std::stoi(value);
+    } else if (key == "maxDepth") {
+        renderer.mMaxDepth = std::stoi(value);
+    } else if (key == "antiAliasing") {
+        renderer.mAntiAliasing = std::stoi(value);
+    } else if (key == "adaptiveAntiAliasing") {
+        if (value == "true") {
+            renderer.mEnableAdaptiveAntiAliasing = true;
+        } else if (value == "false") {
+            renderer.mEnableAdaptiveAntiAliasing = false;
+        } else {
+            std::cout << "Invalid adaptiveAntiAliasing. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid adaptiveAntiAliasing. Must be 'true' or 'false'.";
+        }
+    } else if (key == "contrastThreshold") {
+        renderer.mContrastThreshold = std::stof(value);
+    } else if (key == "iterations") {
+        renderer.mNoiseReduction = std::stoi(value);
+    } else if (key == "convergenceThreshold") {
+        renderer.mConvergenceThreshold = std::stof(value);
+    } else if (key == "timeBudgetSeconds") {
+        renderer.mTimeBudgetSeconds = std::stof(value);
+    } else if (key == "threads") {
+        renderer.mNumThreads = std::stoi(value);
+    } else if (key == "samplingMethod") {
+        if (value == "regular") {
+            renderer.mSamplingMethod = REGULAR;
+        } else if (value == "random") {
+            renderer.mSamplingMethod = RANDOM;
+        } else if (value == "sobol") {
+            renderer.mSamplingMethod = SOBOL;
+        } else if (value == "halton") {
+            renderer.mSamplingMethod = HALTON;
+        } else if (value == "r2") {
+            renderer.mSamplingMethod = R2;
+        } else {
+            std::cout << "Invalid sampling method. Must be 'regular', 'random', 'sobol', 'halton', or 'r2'." << std::endl;
+            throw "Invalid sampling method. Must be 'regular', 'random', 'sobol', 'halton', or 'r2'.";
+        }
+    } else if (key == "useSoftShadows") {
+        if (value == "true") {
+            renderer.mEnableSoftShadows = true;
+        } else if (value == "false") {
+            renderer.mEnableSoftShadows = false;
+        } else {
+            std::cout << "Invalid useSoftShadows. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid useSoftShadows. Must be 'true' or 'false'.";
+        }
+    } else if (key == "adaptiveShadows") {
+        if (value == "true") {
+            renderer.mEnableAdaptiveShadows = true;
+        } else if (value == "false") {
+            renderer.mEnableAdaptiveShadows = false;
+        } else {
+            std::cout << "Invalid adaptiveShadows. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid adaptiveShadows. Must be 'true' or 'false'.";
+        }
+    } else if (key == "adaptiveDepthOfField") {
+        if (value == "true") {
+            renderer.mEnableAdaptiveDepthOfField = true;
+        } else if (value == "false") {
+            renderer.mEnableAdaptiveDepthOfField = false;
+        } else {
+            std::cout << "Invalid adaptiveDepthOfField. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid adaptiveDepthOfField. Must be 'true' or 'false'.";
+        }
+    } else if (key == "lightSamples") {
+        renderer.mLightSamples = std::stoi(value);
+    } else if (key == "shadowProbes") {
+        renderer.mShadowProbes = std::stoi(value);
+    } else if (key == "filterTextures") {
+        if (value == "true") {
+            renderer.mEnableTextureFiltering = true;
+        } else if (value == "false") {
+            renderer.mEnableTextureFiltering = false;
+        } else {
+            std::cout << "Invalid filterTextures. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid filterTextures. Must be 'true' or 'false'.";
+        }
+    } else if (key == "framebufferFormat") {
+        if (value == "float") {
+            renderer.mFramebufferFormat = FLOAT_RGB;
+        } else if (value == "half") {
+            renderer.mFramebufferFormat = HALF_RGB;
+        } else if (value == "rgbe") {
+            renderer.mFramebufferFormat = RGBE;
+        } else {
+            std::cout << "Invalid framebufferFormat. Must be 'float', 'half', or 'rgbe'." << std::endl;
+            throw "Invalid framebufferFormat. Must be 'float', 'half', or 'rgbe'.";
+        }
+    } else if (key == "crop") {
+        auto parts = split(value, ",");
+        if (parts.size() != 4) {
+            std::cout << "Invalid crop. Must be 'x0, y0, x1, y1'." << std::endl;
+            throw "Invalid crop. Must be 'x0, y0, x1, y1'.";
+        }
+        renderer.mCropX0 = std::stoi(parts[0]);
+        renderer.mCropY0 = std::stoi(parts[1]);
+        renderer.mCropX1 = std::stoi(parts[2]);
+        renderer.mCropY1 = std::stoi(parts[3]);
+        if (renderer.mCropX0 > renderer.mCropX1 || renderer.mCropY0 > renderer.mCropY1) {
+            std::cout << "Invalid crop. The first corner must be above and left of the second." << std::endl;
+            throw "Invalid crop. The first corner must be above and left of the second.";
+        }
+        renderer.mEnableCrop = true;
+    } else if (key == "tiles") {
+        auto parts = split(value, "/");
+        if (parts.size() != 2) {
+            std::cout << "Invalid tiles. Must be 'i/N' for part i of N, counting from 0." << std::endl;
+            throw "Invalid tiles. Must be 'i/N' for part i of N, counting from 0.";
+        }
+        renderer.mPart = std::stoi(parts[0]);
+        renderer.mNumParts = std::stoi(parts[1]);
+        if (renderer.mNumParts < 1 || renderer.mPart < 0 || renderer.mPart >= renderer.mNumParts) {
+            std::cout << "Invalid tiles. Must be 'i/N' for part i of N, counting from 0." << std::endl;
+            throw "Invalid tiles. Must be 'i/N' for part i of N, counting from 0.";
+        }
+    } else if (key == "compositeOnto") {
+        renderer.mCompositeFile = value;
+    } else if (key == "streamOutput") {
+        if (value == "true") {
+            renderer.mEnableStreamingOutput = true;
+        } else if (value == "false") {
+            renderer.mEnableStreamingOutput = false;
+        } else {
+            std::cout << "Invalid streamOutput. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid streamOutput. Must be 'true' or 'false'.";
+        }
+    } else if (key == "gamma") {
+        renderer.mGamma = std::stof(value);
+        if (renderer.mGamma <= 0) {
+            std::cout << "Invalid gamma. Must be positive." << std::endl;
+            throw "Invalid gamma. Must be positive.";
+        }
+    } else if (key == "dither") {
+        if (value == "true") {
+            renderer.mEnableDither = true;
+        } else if (value == "false") {
+            renderer.mEnableDither = false;
+        } else {
+            std::cout << "Invalid dither. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid dither. Must be 'true' or 'false'.";
+        }
+    } else if (key == "denoise") {
+        if (value == "true") {
+            renderer.mEnableDenoising = true;
+        } else if (value == "false") {
+            renderer.mEnableDenoising = false;
+        } else {
+            std::cout << "Invalid denoise. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid denoise. Must be 'true' or 'false'.";
+        }
+    } else if (key == "aovs") {
+        renderer.mAovChannels.clear();
+        for (auto name : split(value, ",")) {
+            AovChannel channel;
+            if (!parseAovChannel(trimString(name), channel)) {
+                std::cout << "Invalid aovs. Must be a comma-separated list of depth, normal, objectId, albedo, and rays." << std::endl;
+                throw "Invalid aovs. Must be a comma-separated list of depth, normal, objectId, albedo, and rays.";
+            }
+            renderer.mAovChannels.push_back(channel);
+        }
+    } else if (key == "costPrePass") {
+        if (value == "true") {
+            renderer.mEnableCostPrePass = true;
+        } else if (value == "false") {
+            renderer.mEnableCostPrePass = false;
+        } else {
+            std::cout << "Invalid costPrePass. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid costPrePass. Must be 'true' or 'false'.";
+        }
+    } else if (key == "numaPlacement") {
+        if (value == "true") {
+            renderer.mEnableNumaPlacement = true;
+        } else if (value == "false") {
+            renderer.mEnableNumaPlacement = false;
+        } else {
+            std::cout << "Invalid numaPlacement. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid numaPlacement. Must be 'true' or 'false'.";
+        }
+    } else if (key == "hugePages") {
+        if (value == "true") {
+            renderer.mEnableHugePages = true;
+        } else if (value == "false") {
+            renderer.mEnableHugePages = false;
+        } else {
+            std::cout << "Invalid hugePages. Must be 'true' or 'false'." << std::endl;
+            throw "Invalid hugePages. Must be 'true' or 'false'.";
+        }
+    } else if (key == "outputFile") {
+        renderer.mOutputFile = value;
+    } else {
+        std::cout << "Invalid Renderer key: " << key << std::endl;
+        throw "Invalid renderer key.";
+    }
+}
+
+
+/**
+ * Set the Renderer property `key` to `value`, as a line of a Renderer section
+ * or a command-line override does.
+ */
+void setRendererProperty(Renderer &renderer, std::string key, std::string value) {
+    try {
+        assignRendererProperty(renderer, key, value);
+    } catch (const std::logic_error &) {
+        // std::stoi and std::stof throw std::invalid_argument or std::out_of_range.
+        std::cout << "Invalid " << key << ". Must be a number, not '" << value << "'." << std::endl;
+        throw "Invalid number.";
+    }
+}
+
+
 bool parseRenderer(Renderer &renderer, std::istream &stream, std::string line, std::string tag) {
     if (line != tag) {
         return false;
@@ -297,43 +525,7 @@ bool parseRenderer(Renderer &renderer, std::istream &stream, std::string line, s
 
         std::string key, value;
         std::tie(key, value) = parseKey(row);
-        value = trimString(value);
-        if (key == "width") {
-            renderer.mWidth = std::stoi(value);
-        } else if (key == "height") {
-            renderer.mHeight = std::stoi(value);
-        } else if (key == "maxDepth") {
-            renderer.mMaxDepth = std::stoi(value);
-        } else if (key == "antiAliasing") {
-            renderer.mAntiAliasing = std::stoi(value);
-        } else if (key == "iterations") {
-            renderer.mNoiseReduction = std::stoi(value);
-        } else if (key == "threads") {
-            renderer.mNumThreads = std::stoi(value);
-        } else if (key == "samplingMethod") {
-            if (value == "regular") {
-                renderer.mAntiAliasingMethod = REGULAR;
-            } else if (value == "random") {
-                renderer.mAntiAliasingMethod = RANDOM;
-            } else {
-                std::cout << "Invalid anti-aliasing method. Must be 'regular' or 'random'." << std::endl;
-                throw "Invalid anti-aliasing method. Must be 'regular' or 'random'.";
-            }
-        } else if (key == "useSoftShadows") {
-            if (value == "true") {
-                renderer.mEnableSoftShadows = true;
-            } else if (value == "false") {
-                renderer.mEnableSoftShadows = false;
-            } else {
-                std::cout << "Invalid useSoftShadows. Must be 'true' or 'false'." << std::endl;
-                throw "Invalid useSoftShadows. Must be 'true' or 'false'.";
-            }
-        } else if (key == "outputFile") {
-            renderer.mOutputFile = value;
-        } else {
-            std::cout << "Invalid Renderer key: " << key << std::endl;
-            throw "Invalid renderer key.";
-        }
+        setRendererProperty(renderer, key, trimString(value));
     }
 
     return true;
@@ -435,3 +627,38 @@ bool loadSceneFile(Renderer &renderer, Scene &scene, std::string file) {
 
     return true;
 }
+
+
+/**
+ * Read a command line of the form `[scene file] [--key value]...`, where each
+ * key is a Renderer property that overrides the one in the scene file. Both
+ * `--key value` and `--key=value` work. Returns false if a key has no value.
+ */
+bool parseArguments(int argc, char **argv, std::string &file, RendererOverrides &overrides) {
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument.compare(0, 2, "--") != 0) {
+            file = argument;
+            continue;
+        }
+
+        std::string::size_type equals = argument.find("=");
+        if (equals != std::string::npos) {
+            overrides.push_back(std::make_pair(argument.substr(2, equals - 2), argument.substr(equals + 1)));
+        } else if (i + 1 < argc) {
+            overrides.push_back(std::make_pair(argument.substr(2), std::string(argv[++i])));
+        } else {
+            std::cout << "Missing value for " << argument << ". Usage: " << argv[0] << " [scene file] [--key value]..." << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void applyRendererOverrides(Renderer &renderer, const RendererOverrides &overrides) {
+    for (auto &property : overrides) {
+        setRendererProperty(renderer, property.first, trimString(property.second));
+    }
+}
@@ -8,6 +8,8 @@
 
 #include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "Renderer.h"
 #include "Scene.h"
@@ -15,9 +17,14 @@
 
 typedef std::map<std::string, std::vector<float>> FloatProperties;
 typedef std::map<std::string, std::shared_ptr<Material>> Materials;
+/// Renderer keys and values given on the command line.
+typedef std::vector<std::pair<std::string, std::string>> RendererOverrides;
 
 
+void setRendererProperty(Renderer &renderer, std::string key, std::string value);
 bool loadSceneFile(Renderer &renderer, Scene &scene, std::string file);
+bool parseArguments(int argc, char **argv, std::string &file, RendererOverrides &overrides);
+void applyRendererOverrides(Renderer &renderer, const RendererOverrides &overrides);
 
 
 #endif
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
 #include <string>
@@ -17,6 +19,9 @@ std::string quantityLabels[] = {
 Stats::Stats()
 : id(0)
 , pixels(0)
+, samples(0)
+, shadowTests(0)
+, penumbraTests(0)
 , timeSeconds(0)
 , quantities{ 0 }
 {}
@@ -31,5 +36,109 @@ void Stats::print() {
     for (int i = 0; i < NUM_QUANTITIES; i++) {
         std::cout << std::left << std::setw(20) << std::setfill(' ') << quantityLabels[i] << quantities[i] << std::endl;
     }
+    if (pixels > 0) {
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Samples per Pixel" << samples / (double) pixels << std::endl;
+    }
+    if (shadowTests > 0) {
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Penumbra Fraction" << penumbraTests / (double) shadowTests << std::endl;
+    }
+    printf("\n");
+}
+
+
+/**
+ * Print one row of the aggregate table. The rate column is left empty when
+ * `wallSeconds` is not positive.
+ */
+void printAggregateRow(std::string label, const std::vector<double> &values, float wallSeconds, int precision) {
+    double total = 0;
+    for (double v : values) {
+        total += v;
+    }
+    double mean = total / values.size();
+    double variance = 0;
+    for (double v : values) {
+        variance += (v - mean) * (v - mean);
+    }
+    variance /= values.size();
+
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << label
+              << std::right << std::fixed << std::setprecision(precision)
+              << std::setw(14) << total;
+    if (wallSeconds > 0) {
+        std::cout << std::setw(14) << total / wallSeconds;
+    } else {
+        std::cout << std::setw(14) << "-";
+    }
+    std::cout << std::setw(14) << *std::min_element(values.begin(), values.end())
+              << std::setw(14) << *std::max_element(values.begin(), values.end())
+              << std::setw(14) << sqrt(variance)
+              << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << std::setprecision(6);
+}
+
+
+/**
+ * Summarize every render thread's Stats in one table: the total of each
+ * quantity, its rate over the wall clock time of the render, and its spread
+ * across threads. A large spread in time or pixels means the threads were
+ * poorly balanced.
+ */
+void printAggregateStats(const std::vector<const Stats *> &stats, float wallSeconds) {
+    if (stats.empty()) {
+        return;
+    }
+
+    std::cout << "=== Render Summary ===" << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Wall Time (seconds)" << wallSeconds << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Threads" << stats.size() << std::endl;
+    std::cout << std::endl;
+    std::cout << std::left << std::setw(20) << std::setfill(' ') << "Quantity"
+              << std::right
+              << std::setw(14) << "Total"
+              << std::setw(14) << "Per Second"
+              << std::setw(14) << "Min"
+              << std::setw(14) << "Max"
+              << std::setw(14) << "Std Dev"
+              << std::endl;
+
+    std::vector<double> values;
+    for (auto s : stats) {
+        values.push_back(s->timeSeconds);
+    }
+    printAggregateRow("Time (seconds)", values, 0, 2);
+
+    values.clear();
+    for (auto s : stats) {
+        values.push_back(s->pixels);
+    }
+    printAggregateRow("Pixels", values, wallSeconds, 0);
+
+    for (int i = 0; i < NUM_QUANTITIES; i++) {
+        values.clear();
+        for (auto s : stats) {
+            values.push_back(s->quantities[i]);
+        }
+        printAggregateRow(quantityLabels[i], values, wallSeconds, 0);
+    }
+
+    int64_t pixels = 0;
+    int64_t samples = 0;
+    int64_t shadowTests = 0;
+    int64_t penumbraTests = 0;
+    for (auto s : stats) {
+        pixels += s->pixels;
+        samples += s->samples;
+        shadowTests += s->shadowTests;
+        penumbraTests += s->penumbraTests;
+    }
+    if (pixels > 0) {
+        std::cout << std::endl;
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Samples per Pixel" << samples / (double) pixels << std::endl;
+    }
+    if (shadowTests > 0) {
+        std::cout << std::left << std::setw(20) << std::setfill(' ') << "Penumbra Fraction" << penumbraTests / (double) shadowTests << std::endl;
+    }
     printf("\n");
 }
@@ -6,6 +6,17 @@
 #ifndef _STATS_H_
 #define _STATS_H_
 
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * Every thread increments its own counters on every ray, so each Stats is
+ * aligned to (and padded out to) a cache line to keep threads from
+ * invalidating each other's lines.
+ */
+#define CACHE_LINE_SIZE 64
+
 
 enum Quantities {
     PRIMARY,
@@ -17,11 +28,17 @@ enum Quantities {
 };
 
 
-struct Stats {
+struct alignas(CACHE_LINE_SIZE) Stats {
     int id;
-    int pixels;
+    int64_t pixels;
+    /// Samples taken, whether or not they needed a new primary ray.
+    int64_t samples;
+    /// Lights tested with probe shadow rays, and how many of those tests
+    /// found a penumbra and needed every shadow sample.
+    int64_t shadowTests;
+    int64_t penumbraTests;
     float timeSeconds;
-    int quantities[NUM_QUANTITIES];
+    int64_t quantities[NUM_QUANTITIES];
 
     Stats();
     void print();
@@ -31,4 +48,7 @@ struct Stats {
 typedef struct Stats Stats;
 
 
+void printAggregateStats(const std::vector<const Stats *> &stats, float wallSeconds);
+
+
 #endif
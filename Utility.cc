@@ -1,14 +1,11 @@
-#ifdef __APPLE__
-#  include <OpenGL/gl.h>
-#  include <OpenGL/glu.h>
-#  include <GLUT/glut.h>
-#else
-#  include <GL/gl.h>
-#  include <GL/glu.h>
-#  include <GL/freeglut.h>
-#endif
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
 
 #include "Utility.h"
 #include "Vector.h"
@@ -20,18 +17,45 @@ float getSecondsSince(TimePoint startTime) {
 }
 
 
-float randomFloat() {
-    return 2.0f * (rand() % 100000) / 100000.0f - 1.0f;
+/**
+ * Call `body` with every index from 0 to `count` - 1 across `numThreads`
+ * threads. Threads take the next index as they finish one, so uneven amounts
+ * of work per index still balance.
+ */
+void parallelFor(int count, int numThreads, std::function<void(int)> body) {
+    std::atomic<int> next(0);
+    auto work = [&]() {
+        for (int i = next++; i < count; i = next++) {
+            body(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < std::min(numThreads, count); t++) {
+        threads.push_back(std::thread(work));
+    }
+    work();
+    for (auto &thread : threads) {
+        thread.join();
+    }
 }
 
 
-float randomUnitFloat() {
-    return (rand() % 100000) / 100000.0f;
+/**
+ * Allocate `size` bytes starting on a multiple of `alignment`, which must be a
+ * power of two multiple of sizeof(void *). Release with `freeAligned`.
+ */
+void *allocateAligned(size_t size, size_t alignment) {
+    void *pointer = NULL;
+    if (posix_memalign(&pointer, alignment, size) != 0) {
+        throw std::bad_alloc();
+    }
+    return pointer;
 }
 
 
-Vec3f randomVec3f() {
-    return Vec3f({ randomFloat(), randomFloat(), randomFloat() });
+void freeAligned(void *pointer) {
+    free(pointer);
 }
 
 
@@ -56,24 +80,16 @@ bool rayPlaneIntersection(
 }
 
 
-Vec3f randomDiskPoint(float z, float r) {
-    float R = r * sqrtf(randomUnitFloat());
-    float theta = randomUnitFloat() * 2.0f * M_PI;
+/**
+ * Map a point (u, v) of the unit square to a point on a disk of radius `r`,
+ * keeping the points evenly spread over the disk's area.
+ */
+Vec3f diskPoint(float z, float r, float u, float v) {
+    float R = r * sqrtf(u);
+    float theta = v * 2.0f * M_PI;
     return Vec3f({
         R * cosf(theta),
         R * sinf(theta),
         z
     });
 }
-
-
-void renderImageToGL(int width, int height, Vec3f *image) {
-    glBegin(GL_POINTS);
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            glColor3fv(image[y * width + x].begin());
-            glVertex2i(x, height - y);
-        }
-    }
-    glEnd();
-}
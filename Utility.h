@@ -1,11 +1,13 @@
 /**
  * @file
  * @brief Convenience methods and type definitions for time, random numbers,
- *        and OpenGL.
+ *        and threads.
  */
 #ifndef _UTILITY_H_
 #define _UTILITY_H_
 #include <chrono>
+#include <cstddef>
+#include <functional>
 
 #include "Vector.h"
 
@@ -18,9 +20,14 @@ typedef std::chrono::milliseconds Milli;
 float getSecondsSince(TimePoint startTime);
 
 
-float randomFloat();
-Vec3f randomVec3f();
-Vec3f randomDiskPoint(float z, float r);
+void parallelFor(int count, int numThreads, std::function<void(int)> body);
+
+
+void *allocateAligned(size_t size, size_t alignment);
+void freeAligned(void *pointer);
+
+
+Vec3f diskPoint(float z, float r, float u, float v);
 
 
 bool rayPlaneIntersection(
@@ -32,7 +39,4 @@ bool rayPlaneIntersection(
 );
 
 
-void renderImageToGL(int width, int height, Vec3f *image);
-
-
 #endif
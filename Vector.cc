@@ -77,6 +77,26 @@ Vec3f divide(Vec3f v, float denominator) {
 }
 
 
+/// Multiply two vectors component by component.
+Vec3f multiply(Vec3f u, Vec3f v) {
+    Vec3f output;
+    output[0] = u[0] * v[0];
+    output[1] = u[1] * v[1];
+    output[2] = u[2] * v[2];
+    return output;
+}
+
+
+/// Divide two vectors component by component.
+Vec3f divide(Vec3f u, Vec3f v) {
+    Vec3f output;
+    output[0] = u[0] / v[0];
+    output[1] = u[1] / v[1];
+    output[2] = u[2] / v[2];
+    return output;
+}
+
+
 float dot(Vec3f u, Vec3f v) {
     return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
 }
@@ -89,3 +109,9 @@ Vec3f truncate(Vec3f v, float maximum) {
     output[2] = fmin(v[2], maximum);
     return output;
 }
+
+
+/// Perceived brightness of a linear RGB color (Rec. 709 weights).
+float luminance(Vec3f color) {
+    return 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2];
+}
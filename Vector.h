@@ -42,10 +42,19 @@ Vec3f multiply(Vec3f v, float multiple);
 Vec3f divide(Vec3f v, float denominator);
 
 
+Vec3f multiply(Vec3f u, Vec3f v);
+
+
+Vec3f divide(Vec3f u, Vec3f v);
+
+
 float dot(Vec3f u, Vec3f v);
 
 
 Vec3f truncate(Vec3f v, float maximum);
 
 
+float luminance(Vec3f color);
+
+
 #endif
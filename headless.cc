@@ -0,0 +1,43 @@
+/**
+ * Responsibilities:
+ *   - Boots up a scene file into a Renderer and Scene instance, with
+ *     Renderer keys overridden from the command line
+ *   - Renders and writes the image, then exits without opening a window, for
+ *     machines without a display
+ */
+#include <string>
+
+#include "Renderer.h"
+#include "Scene.h"
+#include "SceneFile.h"
+
+
+int main(int argc, char **argv) {
+    std::string file = "./sample.scene";
+    RendererOverrides overrides;
+    if (!parseArguments(argc, argv, file, overrides)) {
+        return 1;
+    }
+
+    Scene scene;
+    Renderer renderer(scene);
+    renderer.mIsHeadless = true;
+    try {
+        if (!loadSceneFile(renderer, scene, file)) {
+            return 1;
+        }
+        applyRendererOverrides(renderer, overrides);
+    } catch (const char *error) {
+        // The scene file parser has already said what is wrong.
+        return 1;
+    }
+    renderer.printIntro(file);
+    try {
+        renderer.render();
+    } catch (const char *error) {
+        // The renderer has already said what went wrong.
+        return 1;
+    }
+
+    return 0;
+}
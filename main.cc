@@ -1,8 +1,8 @@
 /**
  * Responsibilities:
  *   - Boots up sample.scene into a Renderer and Scene instance
- *   - Creates a GLUT window with an orthographic projection to render the
- *     image into
+ *   - Creates a GLUT window with an orthographic projection to show the
+ *     image in while it renders on a thread of its own
  */
 #ifdef __APPLE__
 #  include <OpenGL/gl.h>
@@ -13,9 +13,13 @@
 #  include <GL/glu.h>
 #  include <GL/freeglut.h>
 #endif
-#include <ctime>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
 #include <string>
+#include <thread>
 
+#include "Preview.h"
 #include "Renderer.h"
 #include "Scene.h"
 #include "SceneFile.h"
@@ -23,12 +27,15 @@
 
 Scene scene;
 Renderer renderer(scene);
+Preview *preview = NULL;
+/// Set once the image has been written.
+std::atomic<bool> isRenderFinished(false);
 
 
 void handleDisplay() {
     glClear(GL_COLOR_BUFFER_BIT);
     glLoadIdentity();
-    renderer.gl();
+    preview->draw();
     glFlush();
 }
 
@@ -55,30 +62,70 @@ void handleReshape(int w, int h) {
 
 void handleKeyboard(unsigned char key, int _x, int _y) {
     if (key == 'q' || key == 'Q') {
-        exit(0);
+        if (isRenderFinished) {
+            exit(0);
+        }
+        // The render threads are still using the renderer, which exit()
+        // would destroy under them.
+        std::cout << std::endl;
+        std::_Exit(0);
+    }
+}
+
+
+/// Show the tiles finished since last time, until the render is done.
+void handleTimer(int value) {
+    // Read before updating so that the tiles of the last pass are shown.
+    bool isFinished = isRenderFinished;
+    if (preview->update()) {
+        glutPostRedisplay();
+    }
+    if (!isFinished) {
+        glutTimerFunc(PREVIEW_INTERVAL_MS, handleTimer, 0);
     }
 }
 
 
 int main(int argc, char **argv) {
-    srand(time(NULL));
     std::string file = "./sample.scene";
-    if (argc == 2) {
-        file = std::string(argv[1]);
+    RendererOverrides overrides;
+    if (!parseArguments(argc, argv, file, overrides)) {
+        return 1;
+    }
+    try {
+        if (!loadSceneFile(renderer, scene, file)) {
+            return 1;
+        }
+        applyRendererOverrides(renderer, overrides);
+    } catch (const char *error) {
+        // The scene file parser has already said what is wrong.
+        return 1;
     }
-    loadSceneFile(renderer, scene, file);
+    renderer.mEnablePreview = true;
     renderer.printIntro(file);
-    renderer.render();
 
     glutInit(&argc, argv);
     glutInitWindowSize(renderer.mWidth, renderer.mHeight);
     glutInitDisplayMode(GLUT_RGB);
     glutCreateWindow("Raytracer Output");
+    preview = new Preview(renderer);
 
     glutDisplayFunc(handleDisplay);
     glutKeyboardFunc(handleKeyboard);
     glutReshapeFunc(handleReshape);
-
+    glutTimerFunc(PREVIEW_INTERVAL_MS, handleTimer, 0);
+
+    std::thread renderThread([]() {
+        try {
+            renderer.render();
+        } catch (const char *error) {
+            // The renderer has already said what went wrong.
+            exit(1);
+        }
+        isRenderFinished = true;
+    });
+    // GLUT never returns from its loop.
+    renderThread.detach();
     glutMainLoop();
 
     return 0;
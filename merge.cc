@@ -0,0 +1,24 @@
+/**
+ * Responsibilities:
+ *   - Merges the partial images that several machines each rendered some of
+ *     the tiles of, with `--tiles i/N`, into the whole image
+ */
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Partial.h"
+
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cout << "Usage: " << argv[0] << " <output file> <partial image>..." << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files(argv + 2, argv + argc);
+    int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    return mergePartialImages(files, argv[1], numThreads) ? 0 : 1;
+}
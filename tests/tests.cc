@@ -1,17 +1,23 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
-#ifdef __APPLE__
-#  include <OpenGL/gl.h>
-#  include <OpenGL/glu.h>
-#  include <GLUT/glut.h>
-#else
-#  include <GL/gl.h>
-#  include <GL/glu.h>
-#  include <GL/freeglut.h>
-#endif
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <zlib.h>
+#include "../Aovs.h"
+#include "../Denoiser.h"
+#include "../Framebuffer.h"
+#include "../ImageFile.h"
+#include "../LightIndex.h"
+#include "../Material.h"
 #include "../Objects.h"
+#include "../Partial.h"
+#include "../PointLight.h"
+#include "../Random.h"
 #include "../Renderer.h"
+#include "../Sampler.h"
 #include "../Scene.h"
+#include "../SceneFile.h"
 #include "../Vector.h"
 
 
@@ -24,6 +30,46 @@ auto m = std::make_shared<Material>(
 );
 
 
+/**
+ * Load a small room with a textured sphere, a mirror and a glass sphere into
+ * `renderer` and `scene`, with `settings` as the lines of its Renderer
+ * section. The image is written to /tmp/render_test.ppm.
+ */
+void loadTestScene(Renderer &renderer, Scene &scene, const std::string settings) {
+    std::ofstream file("/tmp/render_test.scene");
+    file << "Renderer\n" << settings << "outputFile: /tmp/render_test.ppm\n\n"
+         << "CheckerboardMaterial checkers\ncolor: 1, 1, 1\nodd: 0, 0, 0\nambient: 0.2\ndiffuse: 0.8\ngrain: 0.05\n\n"
+         << "Material wall\ncolor: 0.33, 0.94, 0.77\nambient: 0.2\ndiffuse: 0.8\n\n"
+         << "Material mirror\ncolor: 1, 1, 1\nambient: 0\ndiffuse: 0\nspecular: 1\n\n"
+         << "Material glass\nambient: 0\ndiffuse: 0\nspecular: 0\ntransmission: 1\nrefractiveIndex: 1.5\n\n"
+         << "PointLight\nposition: 0, 0.95, -1.3\nradius: 0.3\nintensity: 1\n\n"
+         << "Plane\nmaterial: wall\npoint: 0, 0, -4\nnormal: 0, 0, 1\n\n"
+         << "Plane\nmaterial: wall\npoint: 0, -1, 0\nnormal: 0, 1, 0\n\n"
+         << "Sphere\norigin: -1, -0.5, -2.1\nradius: 0.45\nmaterial: checkers\n\n"
+         << "Sphere\norigin: 1, -0.5, -1.6\nradius: 0.5\nmaterial: mirror\n\n"
+         << "Sphere\norigin: -0.3, -0.4, -0.8\nradius: 0.2\nmaterial: glass\n\n";
+    file.close();
+    REQUIRE(loadSceneFile(renderer, scene, "/tmp/render_test.scene"));
+    remove("/tmp/render_test.scene");
+}
+
+
+/// Whether two renders came out exactly the same.
+bool isSameImage(const Framebuffer &a, const Framebuffer &b) {
+    if (a.mX0 != b.mX0 || a.mY0 != b.mY0 || a.mWidth != b.mWidth || a.mHeight != b.mHeight) {
+        return false;
+    }
+    for (int y = a.mY0; y < a.mY0 + a.mHeight; y++) {
+        for (int x = a.mX0; x < a.mX0 + a.mWidth; x++) {
+            if (a.get(x, y) != b.get(x, y)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
 TEST_CASE("Ray-sphere intersection from outside") {
     Sphere s(m, Vec3f({ 0, 0, -1 }), 0.5f);
     Vec3f rayOrigin = zero;
@@ -196,3 +242,716 @@ TEST_CASE("Just before total internal reflection") {
     computeRefractionDir(rayDirection, normal, 1.5f, isTotalInternalReflection);
     REQUIRE(!isTotalInternalReflection);
 }
+
+
+TEST_CASE("Render thread stats start on their own cache line") {
+    Scene scene;
+    Renderer renderer(scene);
+    REQUIRE(sizeof(Stats) % CACHE_LINE_SIZE == 0);
+    for (int i = 0; i < 4; i++) {
+        std::shared_ptr<RenderThread> t(new RenderThread(&renderer, 1, 1));
+        REQUIRE((uintptr_t) &t->mStats % CACHE_LINE_SIZE == 0);
+    }
+}
+
+
+TEST_CASE("Random generator is deterministic per pixel, sample, and iteration") {
+    Random a, b;
+    a.seed(12345, 3, 7);
+    b.seed(12345, 3, 7);
+    for (int i = 0; i < 16; i++) {
+        REQUIRE(a.nextUInt() == b.nextUInt());
+    }
+
+    b.seed(12345, 3, 8);
+    a.seed(12345, 3, 7);
+    REQUIRE(a.nextUInt() != b.nextUInt());
+
+    float sum = 0;
+    for (int i = 0; i < 10000; i++) {
+        float f = a.nextFloat();
+        REQUIRE(f >= 0);
+        REQUIRE(f < 1);
+        sum += f;
+    }
+    REQUIRE(sum / 10000 == Approx(0.5f).margin(0.02f));
+}
+
+
+TEST_CASE("Sobol sampler stratifies every aligned block of four samples") {
+    SobolSampler sampler;
+    for (uint64_t pixel = 0; pixel < 8; pixel++) {
+        for (int dimension = 0; dimension < 8; dimension += 2) {
+            bool quadrants[4] = { false, false, false, false };
+            for (uint32_t i = 0; i < 4; i++) {
+                sampler.startSample(pixel, i);
+                float u = sampler.get(dimension);
+                float v = sampler.get(dimension + 1);
+                REQUIRE(u >= 0);
+                REQUIRE(u < 1);
+                REQUIRE(v >= 0);
+                REQUIRE(v < 1);
+                quadrants[(u < 0.5f ? 0 : 1) + (v < 0.5f ? 0 : 2)] = true;
+            }
+            REQUIRE(quadrants[0]);
+            REQUIRE(quadrants[1]);
+            REQUIRE(quadrants[2]);
+            REQUIRE(quadrants[3]);
+        }
+    }
+}
+
+
+TEST_CASE("Low-discrepancy samplers are unbiased and decorrelated per pixel") {
+    SamplingMethod methods[] = { RANDOM, SOBOL, HALTON, R2 };
+    for (auto method : methods) {
+        auto sampler = createSampler(method, 1);
+        float sum = 0;
+        for (uint32_t i = 0; i < 1024; i++) {
+            sampler->startSample(1, i);
+            float u = sampler->get(LENS_DIMENSION);
+            REQUIRE(u >= 0);
+            REQUIRE(u < 1);
+            sum += u;
+        }
+        REQUIRE(sum / 1024 == Approx(0.5f).margin(0.02f));
+
+        sampler->startSample(1, 0);
+        float a = sampler->get(LIGHT_DIMENSION);
+        sampler->startSample(2, 0);
+        float b = sampler->get(LIGHT_DIMENSION);
+        REQUIRE(a != b);
+    }
+}
+
+
+TEST_CASE("Shadow samples are stratified and stay inside the light") {
+    Vec3f shift({ 0.3f, 0.6f, 0.9f });
+    Vec3f first = stratifiedPoint(shift, 0, 8);
+    REQUIRE(first[0] == Approx(shift[0]));
+    REQUIRE(first[1] == Approx(shift[1]));
+    REQUIRE(first[2] == Approx(shift[2]));
+
+    PointLight light(Vec3f({ 0, 0, 0 }), 1, 0.5f);
+    bool strata[8] = { false };
+    for (int i = 0; i < 8; i++) {
+        Vec3f point = stratifiedPoint(shift, i, 8);
+        strata[(int) (point[0] * 8)] = true;
+
+        float distance;
+        light.direction(Vec3f({ 0, 0, 2 }), distance, true, point);
+        REQUIRE(distance >= 1.5f - 1e-4f);
+        REQUIRE(distance <= 2.5f + 1e-4f);
+    }
+    for (int i = 0; i < 8; i++) {
+        REQUIRE(strata[i]);
+    }
+}
+
+
+TEST_CASE("Shadow probes that agree skip the other shadow rays") {
+    auto diffuse = std::make_shared<Material>(Vec3f({ 1, 1, 1 }), 0, 0.8f, 0, 0, 0);
+    Scene scene;
+    auto floor = std::make_shared<Plane>(diffuse, Vec3f({ 0, -1, 0 }), Vec3f({ 0, 1, 0 }));
+    scene.mObjects.push_back(floor);
+    scene.mObjects.push_back(std::make_shared<Sphere>(diffuse, Vec3f({ 0, 0, 0 }), 0.5f));
+    PointLight light(Vec3f({ 0, 1, 0 }), 1, 0.3f);
+    light.mShadowSamples = 16;
+    Renderer renderer(scene);
+    renderer.mEnableSoftShadows = true;
+    renderer.mShadowProbes = 4;
+    std::shared_ptr<RenderThread> t(new RenderThread(&renderer, 1, 1));
+
+    // Under the sphere every probe is blocked, and far from it none are.
+    Vec3f points[] = { Vec3f({ 0, -1, 0 }), Vec3f({ 5, -1, 0 }) };
+    Vec3f sample({ 0.3f, 0.6f, 0.9f });
+    for (Vec3f point : points) {
+        Hit hit = { floor.get(), 1, point, Vec3f({ 0, 1, 0 }), 0, zero };
+        renderer.mEnableAdaptiveShadows = false;
+        int64_t before = t->mStats.quantities[SHADOW];
+        Vec3f full = t->shadeLight(hit, &light, sample, Vec3f({ 1, 1, 1 }));
+        REQUIRE(t->mStats.quantities[SHADOW] - before == 16);
+        REQUIRE((full[0] > 0) == (point[0] > 0));
+
+        renderer.mEnableAdaptiveShadows = true;
+        before = t->mStats.quantities[SHADOW];
+        Vec3f probed = t->shadeLight(hit, &light, sample, Vec3f({ 1, 1, 1 }));
+        REQUIRE(t->mStats.quantities[SHADOW] - before == 4);
+        for (int c = 0; c < 3; c++) {
+            REQUIRE(probed[c] == Approx(full[c]));
+        }
+    }
+    REQUIRE(t->mStats.shadowTests == 2);
+    REQUIRE(t->mStats.penumbraTests == 0);
+}
+
+
+TEST_CASE("Adaptive depth of field gives in-focus pixels the fewest iterations") {
+    Camera camera;
+    camera.mPosition = Vec3f({ 0, 0, 0 });
+    camera.mLookAt = Vec3f({ 0, 0, -2 });
+    camera.mApertureRadius = 0.1f;
+    float pixelSize = 0.01f;
+    Vec3f focused({ 0.3f, -0.2f, -2 });
+    REQUIRE(camera.circleOfConfusion(&focused, pixelSize) == Approx(0).margin(1e-5));
+    float previous = 0;
+    for (float offset = 0.25f; offset <= 2; offset += 0.25f) {
+        Vec3f behind({ 0, 0, -2 - offset });
+        float blur = camera.circleOfConfusion(&behind, pixelSize);
+        REQUIRE(blur > previous);
+        previous = blur;
+        Vec3f inFront({ 0, 0, -2 + offset / 2 });
+        REQUIRE(camera.circleOfConfusion(&inFront, pixelSize) > 0);
+    }
+    Vec3f nearer({ 0, 0, -1 });
+    Vec3f near({ 0, 0, -1.5f });
+    REQUIRE(camera.circleOfConfusion(&nearer, pixelSize) > camera.circleOfConfusion(&near, pixelSize));
+    REQUIRE(camera.circleOfConfusion(NULL, pixelSize) == Approx(0.1f / (2 * pixelSize)));
+
+    // A wall at the focal depth is sharp, and one far behind it is blurred
+    // over several pixels through a wide lens.
+    camera.mApertureRadius = 1;
+    auto diffuse = std::make_shared<Material>(Vec3f({ 1, 1, 1 }), 0.2f, 0.8f, 0, 0, 0);
+    for (float depth : { -2.0f, -12.0f }) {
+        Scene scene;
+        scene.mCamera = camera;
+        scene.mObjects.push_back(std::make_shared<Plane>(diffuse, Vec3f({ 0, 0, depth }), Vec3f({ 0, 0, 1 })));
+        scene.mPointLights.push_back(std::make_shared<PointLight>(Vec3f({ 0, 0, -1 }), 1, 0));
+        Renderer renderer(scene);
+        renderer.mWidth = 16;
+        renderer.mHeight = 16;
+        renderer.mNoiseReduction = 8;
+        renderer.mEnableAdaptiveDepthOfField = true;
+        renderer.mLightIndex.build(scene.mPointLights);
+        std::shared_ptr<RenderThread> t(new RenderThread(&renderer, 1, tanf(camera.mFieldOfViewRadians / 2)));
+        t->computePixelAverage(8, 8);
+        REQUIRE(t->mStats.samples == (depth == -2 ? MIN_DEPTH_OF_FIELD_ITERATIONS : 8));
+    }
+}
+
+
+TEST_CASE("Alias table picks items in proportion to their weight") {
+    AliasTable table;
+    table.build({ 1, 0, 3, 4 });
+    REQUIRE(table.size() == 4);
+
+    float weights[] = { 1, 0, 3, 4 };
+    int counts[4] = { 0 };
+    for (int i = 0; i < 8000; i++) {
+        float pdf;
+        int item = table.sample((i + 0.5f) / 8000, pdf);
+        counts[item]++;
+        REQUIRE(pdf == Approx(weights[item] / 8));
+    }
+    REQUIRE(counts[0] == Approx(1000).margin(1));
+    REQUIRE(counts[1] == 0);
+    REQUIRE(counts[2] == Approx(3000).margin(1));
+    REQUIRE(counts[3] == Approx(4000).margin(1));
+}
+
+
+TEST_CASE("Picking some of the lights makes every iteration count") {
+    Scene scene;
+    scene.mPointLights.push_back(std::make_shared<PointLight>(Vec3f({ -1, 1, 0 }), 1, 0));
+    scene.mPointLights.push_back(std::make_shared<PointLight>(Vec3f({ 1, 1, 0 }), 1, 0));
+    Renderer renderer(scene);
+    renderer.mNoiseReduction = 8;
+    REQUIRE(renderer.getIterations() == 1);
+
+    renderer.mLightSamples = 1;
+    REQUIRE(renderer.hasStochasticShading());
+    REQUIRE(renderer.getIterations() == 8);
+
+    renderer.mLightSamples = 2;
+    REQUIRE(renderer.getIterations() == 1);
+}
+
+
+TEST_CASE("Light index finds every light that reaches a point in scene order") {
+    std::vector<std::shared_ptr<PointLight>> lights;
+    for (int i = 0; i < 20; i++) {
+        auto light = std::make_shared<PointLight>(Vec3f({ i * 0.5f, (i % 3) * 0.5f, 0 }), 1, 0);
+        light->mInfluenceRadius = i % 5 == 0 ? 0 : 1;
+        lights.push_back(light);
+    }
+    LightIndex index;
+    index.build(lights);
+
+    for (float x = -2; x < 12; x += 0.37f) {
+        Vec3f point({ x, 0.3f, 0.2f });
+        std::vector<int> expected;
+        for (int i = 0; i < 20; i++) {
+            Vec3f d = subtract(lights[i]->mPosition, point);
+            if (lights[i]->mInfluenceRadius <= 0 || dot(d, d) <= 1) {
+                expected.push_back(i);
+            }
+        }
+
+        std::vector<int> found;
+        for (int i : index.query(point)) {
+            Vec3f d = subtract(lights[i]->mPosition, point);
+            if (lights[i]->mInfluenceRadius <= 0 || dot(d, d) <= 1) {
+                found.push_back(i);
+            }
+        }
+        REQUIRE(found == expected);
+    }
+}
+
+
+TEST_CASE("Filtered checkerboard averages the squares in its footprint") {
+    CheckerboardMaterial checkers(Vec3f({ 1, 1, 1 }), Vec3f({ 0, 0, 0 }), 1, 0, 0, 0, 1, 0.5f);
+    Vec3f point = checkers.getColor(0.2f, 0.3f, 0.7f, Vec3f({ 0, 0, 0 }));
+    Vec3f small = checkers.getColor(0.2f, 0.3f, 0.7f, Vec3f({ 0.01f, 0.01f, 0.01f }));
+    REQUIRE(small[0] == Approx(point[0]).margin(1e-4));
+
+    // Half of a footprint one square wide straddling an edge is on each side.
+    Vec3f edge = checkers.getColor(0.5f, 0.3f, 0.7f, Vec3f({ 0.5f, 0, 0 }));
+    REQUIRE(edge[0] == Approx(0.5f).margin(1e-4));
+
+    // A footprint covering whole periods sees both colors equally.
+    Vec3f wide = checkers.getColor(0.2f, 0.3f, 0.7f, Vec3f({ 3, 0, 0 }));
+    REQUIRE(wide[0] == Approx(0.5f).margin(1e-4));
+}
+
+
+TEST_CASE("PSNR of images") {
+    std::vector<Vec3f> a(16, Vec3f({ 0.5f, 0.5f, 0.5f }));
+    std::vector<Vec3f> b(16, Vec3f({ 0.6f, 0.6f, 0.6f }));
+    REQUIRE(std::isinf(computePSNR(a.data(), a.data(), a.size())));
+    REQUIRE(computePSNR(a.data(), b.data(), a.size()) == Approx(20).margin(1e-3));
+}
+
+
+TEST_CASE("Denoiser smooths noise without blurring across edges") {
+    int width = 64;
+    int height = 32;
+    Framebuffer image(width, height, false);
+    std::vector<Vec3f> clean;
+    Denoiser denoiser(width, height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            // Two walls meeting in the middle, the left one noisy.
+            bool left = x < width / 2;
+            Vec3f color({ 0.2f, 0.2f, 0.2f });
+            if (left) {
+                color = add(Vec3f({ 0.5f, 0.5f, 0.5f }), (x + y) % 2 == 0 ? 0.1f : -0.1f);
+                denoiser.setVariance(x, y, 0.01f);
+            }
+            image.set(x, y, color);
+            clean.push_back(Vec3f({ left ? 0.5f : 0.2f, left ? 0.5f : 0.2f, left ? 0.5f : 0.2f }));
+            denoiser.addSample(x, y, Vec3f({ left ? 1.0f : 0.0f, 0, left ? 0.0f : 1.0f }), Vec3f({ 1, 1, 1 }), 1);
+        }
+    }
+
+    float before = computePSNR(image.data(), clean.data(), clean.size());
+    denoiser.run(&image, 2);
+    REQUIRE(computePSNR(image.data(), clean.data(), clean.size()) > before + 10);
+    REQUIRE(image.get(width / 2, height / 2)[0] == Approx(0.2f).margin(1e-3));
+    REQUIRE(image.get(width / 2 - 1, height / 2)[0] == Approx(0.5f).margin(0.02));
+}
+
+
+TEST_CASE("AOVs keep the first primary hit and average the albedo") {
+    auto sphere = std::make_shared<Sphere>(m, Vec3f({ 0, 0, -1 }), 0.5f);
+    auto plane = std::make_shared<Plane>(m, Vec3f({ 0, -1, 0 }), Vec3f({ 0, 1, 0 }));
+    std::vector<std::shared_ptr<SceneObject>> objects = { sphere, plane };
+    AovChannel channel;
+    REQUIRE(parseAovChannel("objectId", channel));
+    REQUIRE(channel == AOV_OBJECT_ID);
+    REQUIRE_FALSE(parseAovChannel("alpha", channel));
+
+    Aovs aovs(2, 1, { AOV_DEPTH, AOV_OBJECT_ID, AOV_ALBEDO }, objects);
+    REQUIRE(aovs.isEnabled(AOV_DEPTH));
+    REQUIRE_FALSE(aovs.isEnabled(AOV_RAYS));
+    aovs.addSample(0, 0, plane.get(), 3, Vec3f({ 0, 1, 0 }), Vec3f({ 1, 0, 0 }));
+    aovs.addSample(0, 0, sphere.get(), 1, Vec3f({ 0, 0, 1 }), Vec3f({ 0, 0, 1 }));
+    aovs.addSample(1, 0, NULL, 0, zero, zero);
+    aovs.write("/tmp/aovs_test.ppm");
+
+    std::ifstream file("/tmp/aovs_test.objectId.pfm", std::ios::binary);
+    std::string magic;
+    int width, height;
+    float scale;
+    file >> magic >> width >> height >> scale;
+    file.get();
+    float ids[2];
+    file.read((char *) ids, sizeof(ids));
+    REQUIRE(magic == "Pf");
+    REQUIRE(ids[0] == 1);
+    REQUIRE(ids[1] == -1);
+
+    std::ifstream albedoFile("/tmp/aovs_test.albedo.pfm", std::ios::binary);
+    albedoFile >> magic >> width >> height >> scale;
+    albedoFile.get();
+    float albedo[3];
+    albedoFile.read((char *) albedo, sizeof(albedo));
+    REQUIRE(magic == "PF");
+    REQUIRE(albedo[0] == 0.5f);
+    REQUIRE(albedo[2] == 0.5f);
+
+    remove("/tmp/aovs_test.depth.pfm");
+    remove("/tmp/aovs_test.objectId.pfm");
+    remove("/tmp/aovs_test.albedo.pfm");
+}
+
+
+TEST_CASE("Image encoder clamps, gamma corrects and dithers") {
+    Vec3f pixels[4] = {
+        Vec3f({ -0.5f, 1.5f, 0.5f }),
+        Vec3f({ 0, 1, 0.25f }),
+        Vec3f({ 0.5f, 0.5f, 0.5f }),
+        Vec3f({ 0.5f, 0.5f, 0.5f })
+    };
+    unsigned char out[12];
+    ImageEncoder linear(1, false);
+    linear.encode(pixels, 2, 0, 0, out);
+    REQUIRE(out[0] == 0);
+    REQUIRE(out[1] == 255);
+    REQUIRE(out[2] == 127);
+    REQUIRE(out[5] == 63);
+
+    ImageEncoder gamma(2.2f, false);
+    gamma.encode(pixels, 1, 0, 0, out);
+    REQUIRE(out[2] == 186);
+
+    // A flat 0.5 dithers to a mix of the two nearest levels averaging 127.5.
+    Vec3f gray[16];
+    std::fill(gray, gray + 16, Vec3f({ 0.5f, 0.5f, 0.5f }));
+    int total = 0;
+    for (int y = 0; y < 4; y++) {
+        unsigned char row[12];
+        ImageEncoder(1, true).encode(gray, 4, 0, y, row);
+        for (int i = 0; i < 12; i += 3) {
+            REQUIRE((row[i] == 127 || row[i] == 128));
+            total += row[i];
+        }
+    }
+    REQUIRE(total == 127 * 8 + 128 * 8);
+}
+
+
+TEST_CASE("Adaptive anti-aliasing gives the same pixels for any number of threads") {
+    std::string settings = "width: 96\nheight: 64\nantiAliasing: 16\nadaptiveAntiAliasing: true\ncostPrePass: true\n";
+    Scene oneScene, fourScene;
+    Renderer one(oneScene), four(fourScene);
+    loadTestScene(one, oneScene, settings + "threads: 1\n");
+    loadTestScene(four, fourScene, settings + "threads: 4\n");
+    one.render();
+    four.render();
+    REQUIRE(one.mTiles.size() != four.mTiles.size());
+    REQUIRE(isSameImage(*one.getImage(), *four.getImage()));
+    remove("/tmp/render_test.ppm");
+}
+
+
+TEST_CASE("Cached primary hits give the same pixels as tracing them again") {
+    std::string settings = "width: 48\nheight: 32\nantiAliasing: 4\nsamplingMethod: regular\n"
+                           "useSoftShadows: true\niterations: 6\nfilterTextures: true\nthreads: 2\n";
+    Scene cachedScene, tracedScene;
+    Renderer cached(cachedScene), traced(tracedScene);
+    loadTestScene(cached, cachedScene, settings);
+    loadTestScene(traced, tracedScene, settings);
+    traced.mEnablePrimaryHitCache = false;
+    cached.render();
+    traced.render();
+    REQUIRE(cached.mCachePrimaryHits);
+    REQUIRE_FALSE(traced.mCachePrimaryHits);
+    REQUIRE(isSameImage(*cached.getImage(), *traced.getImage()));
+    remove("/tmp/render_test.ppm");
+}
+
+
+TEST_CASE("Streamed tiles make the same file as writing the whole image") {
+    int width = 5;
+    int height = 3;
+    Framebuffer image(width, height, false);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            image.set(x, y, Vec3f({ x / 4.0f, y / 2.0f, 0.3f }));
+        }
+    }
+    ImageEncoder encoder(2.2f, true);
+    writeImage("/tmp/stream_test_whole.ppm", image, encoder, 1);
+
+    {
+        ImageStream stream("/tmp/stream_test_tiles.ppm", width, height, encoder);
+        // Tiles finish in any order.
+        int tiles[4][4] = { { 3, 2, 4, 2 }, { 0, 0, 2, 1 }, { 0, 2, 2, 2 }, { 3, 0, 4, 1 } };
+        for (auto &t : tiles) {
+            Framebuffer tile(t[0], t[1], t[2] - t[0] + 1, t[3] - t[1] + 1, false, FLOAT_RGB);
+            for (int y = t[1]; y <= t[3]; y++) {
+                for (int x = t[0]; x <= t[2]; x++) {
+                    tile.set(x, y, image.get(x, y));
+                }
+            }
+            REQUIRE(stream.commitTile(tile));
+        }
+        REQUIRE(stream.size() == 11 + 45);
+    }
+
+    std::ifstream whole("/tmp/stream_test_whole.ppm", std::ios::binary);
+    std::ifstream tiles("/tmp/stream_test_tiles.ppm", std::ios::binary);
+    std::string wholeBytes((std::istreambuf_iterator<char>(whole)), std::istreambuf_iterator<char>());
+    std::string tileBytes((std::istreambuf_iterator<char>(tiles)), std::istreambuf_iterator<char>());
+    REQUIRE(wholeBytes.size() == 56);
+    REQUIRE(wholeBytes == tileBytes);
+    remove("/tmp/stream_test_whole.ppm");
+    remove("/tmp/stream_test_tiles.ppm");
+}
+
+
+TEST_CASE("A cropped image composites into the whole image") {
+    int width = 9;
+    int height = 7;
+    Framebuffer image(width, height, false);
+    Framebuffer crop(2, 3, 5, 2, false, FLOAT_RGB);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            image.set(x, y, Vec3f({ x / 8.0f, y / 6.0f, 0.3f }));
+            if (x >= 2 && x < 7 && y >= 3 && y < 5) {
+                crop.set(x, y, image.get(x, y));
+            }
+        }
+    }
+    ImageEncoder encoder(2.2f, true);
+    writeImage("/tmp/crop_test_whole.ppm", image, encoder, 2);
+    writeImage("/tmp/crop_test_crop.ppm", crop, encoder, 2);
+
+    int cropWidth, cropHeight;
+    std::vector<unsigned char> cropPixels;
+    REQUIRE(readImage("/tmp/crop_test_crop.ppm", cropWidth, cropHeight, cropPixels));
+    REQUIRE(cropWidth == 5);
+    REQUIRE(cropHeight == 2);
+    int wholeWidth, wholeHeight;
+    std::vector<unsigned char> wholePixels;
+    REQUIRE(readImage("/tmp/crop_test_whole.ppm", wholeWidth, wholeHeight, wholePixels));
+    // Dithered by position in the whole image, so the crop is the same bytes.
+    for (int y = 0; y < 2; y++) {
+        REQUIRE(std::equal(&cropPixels[y * 15], &cropPixels[y * 15 + 15], &wholePixels[((3 + y) * width + 2) * 3]));
+    }
+
+    std::ofstream black("/tmp/crop_test_black.ppm", std::ios::binary);
+    black << "P6\n# black\n9 7\n255\n" << std::string(width * height * 3, '\0');
+    black.close();
+    REQUIRE(compositeImage("/tmp/crop_test_out.ppm", "/tmp/crop_test_black.ppm", width, height, crop, encoder, 2) > 0);
+    REQUIRE(compositeImage("/tmp/crop_test_out.ppm", "/tmp/crop_test_black.ppm", 8, height, crop, encoder, 2) == 0);
+    std::vector<unsigned char> composite;
+    REQUIRE(readImage("/tmp/crop_test_out.ppm", wholeWidth, wholeHeight, composite));
+    for (size_t i = 0; i < composite.size(); i++) {
+        int x = i / 3 % width;
+        int y = i / 3 / width;
+        bool isInside = x >= 2 && x < 7 && y >= 3 && y < 5;
+        REQUIRE(composite[i] == (isInside ? wholePixels[i] : 0));
+    }
+    remove("/tmp/crop_test_whole.ppm");
+    remove("/tmp/crop_test_crop.ppm");
+    remove("/tmp/crop_test_black.ppm");
+    remove("/tmp/crop_test_out.ppm");
+}
+
+
+TEST_CASE("Partial images merge into the whole image") {
+    int width = 10;
+    int height = 6;
+    Framebuffer image(width, height, false);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            image.set(x, y, Vec3f({ x / 9.0f, y / 5.0f, 0.7f }));
+        }
+    }
+    ImageEncoder encoder(2.2f, true);
+    writeImage("/tmp/partial_test_whole.ppm", image, encoder, 1);
+
+    std::vector<Tile> tiles;
+    for (int y = 0; y < height; y += 4) {
+        for (int x = 0; x < width; x += 4) {
+            tiles.push_back(Tile{ x, y, std::min(width - 1, x + 3), std::min(height - 1, y + 3), 0, false });
+        }
+    }
+    std::vector<std::string> files;
+    for (int part = 0; part < 4; part++) {
+        std::vector<Tile> partTiles = selectPartTiles(tiles, part, 4);
+        REQUIRE(partTiles.size() == (part < 2 ? 2 : 1));
+        PartialHeader header = { width, height, Tile{ 0, 0, width - 1, height - 1, 0, false }, part, 4, 2.2f, true, partTiles };
+        files.push_back(getPartialFile("/tmp/partial_test_merged.ppm", part));
+        REQUIRE(writePartialImage(files.back(), header, image) > 0);
+    }
+
+    PartialHeader header;
+    std::vector<Vec3f> pixels;
+    REQUIRE(readPartialImage(files[1], header, pixels));
+    REQUIRE(header.part == 1);
+    REQUIRE(header.gamma == 2.2f);
+    REQUIRE(pixels.size() == 16 + 4);
+    REQUIRE(pixels[5] == image.get(5, 1));
+
+    // Corrupt headers are rejected before anything is sized by them.
+    PartialHeader corrupt = header;
+    corrupt.numParts = 2000000000;
+    REQUIRE(writePartialImage("/tmp/partial_test_corrupt", corrupt, image) > 0);
+    REQUIRE_FALSE(mergePartialImages({ "/tmp/partial_test_corrupt" }, "/tmp/partial_test_merged.ppm", 2));
+    corrupt = header;
+    corrupt.region.x1 = width;
+    REQUIRE(writePartialImage("/tmp/partial_test_corrupt", corrupt, image) > 0);
+    REQUIRE_FALSE(readPartialImage("/tmp/partial_test_corrupt", corrupt, pixels));
+    remove("/tmp/partial_test_corrupt");
+
+    REQUIRE_FALSE(mergePartialImages({ files[0], files[1], files[3] }, "/tmp/partial_test_merged.ppm", 2));
+    REQUIRE_FALSE(mergePartialImages({ files[0], files[1], files[1], files[3] }, "/tmp/partial_test_merged.ppm", 2));
+    REQUIRE(mergePartialImages({ files[2], files[0], files[3], files[1] }, "/tmp/partial_test_merged.ppm", 2));
+    std::ifstream whole("/tmp/partial_test_whole.ppm", std::ios::binary);
+    std::ifstream merged("/tmp/partial_test_merged.ppm", std::ios::binary);
+    std::string wholeBytes((std::istreambuf_iterator<char>(whole)), std::istreambuf_iterator<char>());
+    std::string mergedBytes((std::istreambuf_iterator<char>(merged)), std::istreambuf_iterator<char>());
+    REQUIRE(wholeBytes == mergedBytes);
+    remove("/tmp/partial_test_whole.ppm");
+    remove("/tmp/partial_test_merged.ppm");
+    for (auto &file : files) {
+        remove(file.c_str());
+    }
+}
+
+
+TEST_CASE("QOI and PNG output") {
+    REQUIRE(getImageFormat("out.ppm") == PPM);
+    REQUIRE(getImageFormat("out.QOI") == QOI);
+    REQUIRE(getImageFormat("dir.png/out") == PPM);
+    REQUIRE(getImageFormat("out.png") == PNG);
+
+    // A black image is one run from the black QOI starts from.
+    std::vector<unsigned char> black(3 * 10 * 6, 0);
+    std::vector<unsigned char> qoi = encodeQoi(black.data(), 10, 6);
+    REQUIRE(qoi.size() == 14 + 1 + 8);
+    REQUIRE(qoi[14] == (0xc0 | 59));
+
+    // Enough rows for several strips, inflated and unfiltered again.
+    int width = 37;
+    int height = 150;
+    size_t rowBytes = width * 3;
+    std::vector<unsigned char> pixels(rowBytes * height);
+    Random random;
+    random.seed(7, 0, 0);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        pixels[i] = i % 3 == 0 ? (i / rowBytes) : random.nextFloat() * 255;
+    }
+    std::vector<unsigned char> png = encodePng(pixels.data(), width, height, 4);
+    REQUIRE(png[1] == 'P');
+    std::vector<unsigned char> stream;
+    size_t offset = 8;
+    while (offset < png.size()) {
+        auto readBigEndian = [&](size_t i) {
+            return (uint32_t) png[i] << 24 | png[i + 1] << 16 | png[i + 2] << 8 | png[i + 3];
+        };
+        size_t size = readBigEndian(offset);
+        REQUIRE(crc32(0, &png[offset + 4], size + 4) == readBigEndian(offset + 8 + size));
+        if (std::string((const char *) &png[offset + 4], 4) == "IDAT") {
+            stream.insert(stream.end(), &png[offset + 8], &png[offset + 8 + size]);
+        }
+        offset += size + 12;
+    }
+    std::vector<unsigned char> filtered((rowBytes + 1) * height);
+    uLongf filteredSize = filtered.size();
+    // Checks the combined Adler-32 as well.
+    REQUIRE(uncompress(filtered.data(), &filteredSize, stream.data(), stream.size()) == Z_OK);
+    REQUIRE(filteredSize == filtered.size());
+    std::vector<unsigned char> decoded(pixels.size());
+    for (int y = 0; y < height; y++) {
+        int filter = filtered[y * (rowBytes + 1)];
+        for (size_t i = 0; i < rowBytes; i++) {
+            int left = i >= 3 ? decoded[y * rowBytes + i - 3] : 0;
+            int up = y > 0 ? decoded[(y - 1) * rowBytes + i] : 0;
+            int upLeft = y > 0 && i >= 3 ? decoded[(y - 1) * rowBytes + i - 3] : 0;
+            int p = left + up - upLeft;
+            int paeth = abs(p - left) <= abs(p - up) && abs(p - left) <= abs(p - upLeft) ? left : abs(p - up) <= abs(p - upLeft) ? up : upLeft;
+            int predicted[5] = { 0, left, up, (left + up) / 2, paeth };
+            decoded[y * rowBytes + i] = filtered[y * (rowBytes + 1) + 1 + i] + predicted[filter];
+        }
+    }
+    REQUIRE(decoded == pixels);
+}
+
+
+TEST_CASE("Command-line overrides of Renderer keys") {
+    const char *argv[] = { "RayHeadless", "--threads", "3", "scene.scene", "--outputFile=out.png", "--dither", " true" };
+    std::string file;
+    RendererOverrides overrides;
+    REQUIRE(parseArguments(7, (char **) argv, file, overrides));
+    REQUIRE(file == "scene.scene");
+    REQUIRE(overrides.size() == 3);
+
+    Scene scene;
+    Renderer renderer(scene);
+    applyRendererOverrides(renderer, overrides);
+    REQUIRE(renderer.mNumThreads == 3);
+    REQUIRE(renderer.mOutputFile == "out.png");
+    REQUIRE(renderer.mEnableDither);
+    REQUIRE_THROWS(setRendererProperty(renderer, "dither", "maybe"));
+
+    const char *missing[] = { "RayHeadless", "--threads" };
+    REQUIRE_FALSE(parseArguments(2, (char **) missing, file, overrides));
+}
+
+
+TEST_CASE("Compact framebuffer formats") {
+    REQUIRE(floatToHalf(1.0f) == 0x3c00);
+    REQUIRE(floatToHalf(-2.0f) == 0xc000);
+    REQUIRE(floatToHalf(65520.0f) == 0x7c00);
+    REQUIRE(halfToFloat(0x3555) == Approx(0.33325f).epsilon(1e-4));
+    REQUIRE(halfToFloat(0x0001) == ldexpf(1, -24));
+    Random random;
+    random.seed(7, 0, 0);
+    for (int i = 0; i < 1000; i++) {
+        float value = random.nextFloat() * 4;
+        REQUIRE(halfToFloat(floatToHalf(value)) == Approx(value).epsilon(1.0 / 2048));
+        REQUIRE(floatToHalf(halfToFloat(floatToHalf(value))) == floatToHalf(value));
+    }
+
+    Framebuffer half(0, 0, 2, 1, false, HALF_RGB);
+    Framebuffer rgbe(0, 0, 2, 1, false, RGBE);
+    REQUIRE(half.getBytes() == 12);
+    REQUIRE(rgbe.getBytes() == 8);
+    Vec3f color({ 0.8f, 0.25f, 0.01f });
+    half.set(1, 0, color);
+    rgbe.set(1, 0, color);
+    rgbe.set(0, 0, zero);
+    for (int c = 0; c < 3; c++) {
+        REQUIRE(half.get(1, 0)[c] == Approx(color[c]).epsilon(1.0 / 2048));
+    }
+    REQUIRE(rgbe.get(0, 0)[0] == 0);
+
+    // What matters is the 8-bit image, which is gamma corrected. Pure colors
+    // and greys come out exactly, and other colors within a couple of levels
+    // as long as no channel is far darker than the largest, as RGBE channels
+    // are only as precise as the largest one.
+    ImageEncoder encoder(2.2f, false);
+    auto encodeBoth = [&](Vec3f value, unsigned char *expected, unsigned char *actual) {
+        rgbe.set(1, 0, value);
+        Vec3f stored = rgbe.get(1, 0);
+        encoder.encode(&value, 1, 0, 0, expected);
+        encoder.encode(&stored, 1, 0, 0, actual);
+    };
+    Vec3f exact[] = {
+        Vec3f({ 1, 0, 0 }), Vec3f({ 0, 1, 0 }), Vec3f({ 0, 0, 1 }), Vec3f({ 1, 1, 0 }),
+        Vec3f({ 0.5f, 0.5f, 0.5f }), Vec3f({ 0.25f, 0, 0.25f }), Vec3f({ 1, 1, 1 })
+    };
+    for (Vec3f value : exact) {
+        unsigned char expected[3], actual[3];
+        encodeBoth(value, expected, actual);
+        for (int c = 0; c < 3; c++) {
+            REQUIRE(actual[c] == expected[c]);
+        }
+    }
+    for (int i = 0; i < 1000; i++) {
+        Vec3f value({ random.nextFloat(), random.nextFloat(), random.nextFloat() });
+        float largest = std::max(value[0], std::max(value[1], value[2]));
+        for (int c = 0; c < 3; c++) {
+            value[c] = std::max(value[c], largest / 8);
+        }
+        unsigned char expected[3], actual[3];
+        encodeBoth(value, expected, actual);
+        for (int c = 0; c < 3; c++) {
+            REQUIRE(std::abs(actual[c] - expected[c]) <= 2);
+        }
+    }
+}